@@ -0,0 +1,121 @@
+/**
+ * Benchmark of the defrag copy kernel (mem_move_down) against memmove.
+ *
+ * A buffer is filled with blocks separated by holes and then compacted the
+ * same way tm_defrag does it: every block slides down to close the holes
+ * below it. This is repeated for several block size distributions.
+ *
+ * Build and run from the repository root:
+ *      gcc -std=gnu99 -fgnu89-inline -O2 -Iplatform -Isrc src/tinymem.c bench/bench_copy.c -o bench_copy
+ *      ./bench_copy
+ */
+#include "tinymem.h"
+
+#define ARENA_BYTES     (64uL * 1024 * 1024)
+#define ROUNDS          (5)
+
+void            mem_move_down(void *to, const void *from, const tm_size_t bytes);
+
+typedef void    (*move_fn)(void *to, const void *from, tm_size_t bytes);
+
+typedef struct {
+    const char  *name;
+    uint32_t    min;        // smallest block in bytes
+    uint32_t    max;        // largest block in bytes
+} distribution;
+
+typedef struct {
+    uint32_t    loc;
+    uint32_t    size;
+} block;
+
+static uint8_t  arena[ARENA_BYTES];
+static block    blocks[ARENA_BYTES / 16];
+
+void            move_memmove(void *to, const void *from, tm_size_t bytes){
+    memmove(to, from, bytes);
+}
+
+double          now_us(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+uint32_t        layout(const distribution *d){
+    // place blocks with a hole (of a random block size) between every
+    // other block. Returns the number of blocks
+    uint32_t count = 0, loc = 0, size;
+    srand(777);
+    while(1){
+        size = (d->min + rand() % (d->max - d->min + 1)) & ~3u;
+        if(!size) size = 4;
+        if(rand() % 2) loc += size;     // leave a hole
+        if(loc + size > ARENA_BYTES) break;
+        blocks[count++] = (block) {.loc = loc, .size = size};
+        memset(arena + loc, (uint8_t)count, size);
+        loc += size;
+    }
+    return count;
+}
+
+double          compact(const uint32_t count, move_fn move, uint64_t *moved){
+    uint32_t i, heap = 0;
+    double start = now_us();
+    *moved = 0;
+    for(i=0; i<count; i++){
+        if(blocks[i].loc != heap){
+            move(arena + heap, arena + blocks[i].loc, blocks[i].size);
+            *moved += blocks[i].size;
+        }
+        heap += blocks[i].size;
+    }
+    return now_us() - start;
+}
+
+bool            compacted(const uint32_t count){
+    uint32_t i, j, heap = 0;
+    for(i=0; i<count; i++){
+        for(j=0; j<blocks[i].size; j++){
+            if(arena[heap + j] != (uint8_t)(i + 1)) return false;
+        }
+        heap += blocks[i].size;
+    }
+    return true;
+}
+
+int main(){
+    const distribution dists[] = {
+        {"small   (4B-64B)",      4,          64},
+        {"medium  (64B-2KB)",     64,         2048},
+        {"large   (2KB-64KB)",    2048,       65536},
+        {"mixed   (4B-256KB)",    4,          262144},
+    };
+    const struct {const char *name; move_fn move;} fns[] = {
+        {"memmove",         move_memmove},
+        {"mem_move_down",   mem_move_down},
+    };
+    uint8_t d, f, r;
+    uint32_t count;
+    uint64_t moved;
+    double t, best;
+
+    printf("%-20s %-15s %10s %10s\n", "distribution", "kernel", "MB moved", "GB/s");
+    for(d=0; d<sizeof(dists)/sizeof(dists[0]); d++){
+        for(f=0; f<sizeof(fns)/sizeof(fns[0]); f++){
+            best = 0;
+            for(r=0; r<ROUNDS; r++){
+                count = layout(&dists[d]);
+                t = compact(count, fns[f].move, &moved);
+                if(!compacted(count)){
+                    printf("[ERROR] %s corrupted data\n", fns[f].name);
+                    return 1;
+                }
+                if(!best || t < best) best = t;
+            }
+            printf("%-20s %-15s %10.1f %10.2f\n", dists[d].name, fns[f].name,
+                   moved / 1e6, moved / best / 1e3);
+        }
+    }
+    return 0;
+}
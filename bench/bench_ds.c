@@ -0,0 +1,167 @@
+/**
+ * Compare the index linked containers (tinymem_ds.h) with the same
+ * containers linked by pointers and allocated with malloc.
+ *
+ * Reports the memory footprint per element (including allocator overhead:
+ * malloc headers, or the index table of tinymem) and the throughput of map
+ * lookups and list traversal.
+ *
+ *      gcc -std=gnu99 -fgnu89-inline -O2 -Iplatform -Isrc bench/bench_ds.c src/tinymem_ds.c -o bench_ds
+ *
+ * The library is included directly so the pool counters can be read.
+ */
+#include <malloc.h>
+#include "../src/tinymem.c"
+#include "tinymem_ds.h"
+
+#define ELEMENTS        (5000)
+#define LOOKUPS         (20000000)
+#define TRAVERSALS      (4000)
+
+/*---------------------------------------------------------------------------*/
+/*      pointer based equivalents                                            */
+typedef struct pnode {
+    struct pnode    *prev;
+    struct pnode    *next;
+    uint32_t        value;
+} pnode;
+
+typedef struct pentry {
+    struct pentry   *next;
+    uint32_t        key;
+    uint32_t        value;
+} pentry;
+
+typedef struct {
+    pentry          **buckets;
+    uint32_t        size;
+    uint32_t        count;
+} pmap;
+
+static inline uint32_t hash_bucket(const uint32_t size, const uint32_t key){
+    uint32_t hash = key * 2654435769u;
+    return (hash ^ (hash >> 16)) & (size - 1);
+}
+
+pentry          *pmap_get(const pmap *map, const uint32_t key){
+    pentry *e = map->buckets[hash_bucket(map->size, key)];
+    while(e && e->key != key) e = e->next;
+    return e;
+}
+
+void            pmap_put(pmap *map, const uint32_t key, const uint32_t value){
+    uint32_t i, size;
+    pentry **buckets, *e, *next;
+    e = malloc(sizeof(pentry));
+    e->key = key;
+    e->value = value;
+    e->next = map->buckets[hash_bucket(map->size, key)];
+    map->buckets[hash_bucket(map->size, key)] = e;
+    if(++map->count <= map->size) return;
+    size = map->size * 2;
+    buckets = calloc(size, sizeof(pentry *));
+    for(i=0; i<map->size; i++){
+        for(e=map->buckets[i]; e; e=next){
+            next = e->next;
+            e->next = buckets[hash_bucket(size, e->key)];
+            buckets[hash_bucket(size, e->key)] = e;
+        }
+    }
+    free(map->buckets);
+    map->buckets = buckets;
+    map->size = size;
+}
+
+/*---------------------------------------------------------------------------*/
+typedef struct {
+    tm_list_node    node;
+    uint32_t        value;
+} tnode;
+
+double          now_s(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+size_t          heap_used(){
+    return mallinfo2().uordblks;
+}
+
+size_t          pool_used(){
+    // data in the pool plus the index lookup and bit arrays of used indexes
+    return (size_t)tm_pool.filled_blocks * TM_BLOCK_SIZE
+        + (size_t)tm_pool.ptrs_filled * sizeof(poolptr)
+        + (size_t)tm_pool.ptrs_filled * 2 / 8;
+}
+
+void            report(const char *name, size_t bytes, double ops, double secs){
+    printf("%-22s %10.1f %14.1f\n", name, (double)bytes / ELEMENTS, ops / secs / 1e6);
+}
+
+int main(){
+    uint32_t i, r, sum = 0;
+    uint32_t *keys = malloc(ELEMENTS * sizeof(uint32_t));
+    size_t before;
+    double start;
+    pmap pm = {.buckets = calloc(4, sizeof(pentry *)), .size = 4, .count = 0};
+    pnode *plist = NULL, *pn;
+    tm_map tmap;
+    tm_list tlist = {0};
+    tm_index_t index;
+
+    srand(777);
+    for(i=0; i<ELEMENTS; i++) keys[i] = rand();
+    tm_reset();
+
+    printf("%-22s %10s %14s\n", "container", "bytes/elem", "Mops/s");
+    // map: pointers
+    before = heap_used() - 4 * sizeof(pentry *);
+    for(i=0; i<ELEMENTS; i++) pmap_put(&pm, keys[i], i);
+    r = heap_used() - before;
+    start = now_s();
+    for(i=0; i<LOOKUPS; i++) sum += pmap_get(&pm, keys[i % ELEMENTS])->value;
+    report("map (pointers)", r, LOOKUPS, now_s() - start);
+
+    // map: tinymem
+    tm_map_init(&tmap, 4, sizeof(uint32_t));
+    for(i=0; i<ELEMENTS; i++) *(uint32_t *)tm_map_value_p(tm_map_put(&tmap, keys[i])) = i;
+    start = now_s();
+    for(i=0; i<LOOKUPS; i++) sum += *(uint32_t *)tm_map_value_p(tm_map_get(&tmap, keys[i % ELEMENTS]));
+    report("map (tm_index_t)", pool_used(), LOOKUPS, now_s() - start);
+    tm_map_free(&tmap);
+
+    // list: pointers
+    before = heap_used();
+    for(i=0; i<ELEMENTS; i++){
+        pn = malloc(sizeof(pnode));
+        pn->value = i;
+        pn->prev = NULL;
+        pn->next = plist;
+        if(plist) plist->prev = pn;
+        plist = pn;
+    }
+    r = heap_used() - before;
+    start = now_s();
+    for(i=0; i<TRAVERSALS; i++){
+        for(pn=plist; pn; pn=pn->next) sum += pn->value;
+    }
+    report("list (pointers)", r, (double)TRAVERSALS * ELEMENTS, now_s() - start);
+
+    // list: tinymem
+    tm_reset();
+    for(i=0; i<ELEMENTS; i++){
+        index = tm_alloc(sizeof(tnode));
+        ((tnode *)tm_void_p(index))->value = i;
+        tm_list_push_front(&tlist, index);
+    }
+    start = now_s();
+    for(i=0; i<TRAVERSALS; i++){
+        for(index=tlist.first; index; index=tm_list_next(index)){
+            sum += ((tnode *)tm_void_p(index))->value;
+        }
+    }
+    report("list (tm_index_t)", pool_used(), (double)TRAVERSALS * ELEMENTS, now_s() - start);
+
+    return sum == 42;   // keep sum alive
+}
@@ -0,0 +1,79 @@
+/**
+ * Compare referencing and defrag speed of a pool on normal pages against a
+ * pool on huge pages. Build with huge pages enabled (TM_HUGEPAGE_SIZE and
+ * TM_HUGEPAGE_MAP, see tinymem_platform.h), then run:
+ *
+ *      gcc -std=gnu99 -fgnu89-inline -O2 -Iplatform -Isrc -DTM_HUGEPAGE_SIZE=2097152 \
+ *          '-DTM_HUGEPAGE_MAP(p,b)=tm_linux_hugepage(p,b)' bench/bench_hugepage.c -o bench_hugepage
+ *      ./bench_hugepage            # normal pages
+ *      ./bench_hugepage huge       # huge pages
+ *
+ * The pool is at most TM_POOL_SIZE bytes, so the difference grows with
+ * TM_BLOCK_SIZE (which sets the maximum pool size).
+ *
+ * The library is included directly so the pool can be inspected.
+ */
+#include "../src/tinymem.c"
+
+#define DEREFS          (50000000uL)
+#define DEFRAGS         (2000)
+
+tm_index_t      indexes[TM_POOL_INDEXES];
+
+double          now_s(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+tm_index_t      fill(){
+    // fill the pool with objects that together use all of it
+    tm_index_t count = 0;
+    tm_size_t size = TM_POOL_SIZE / (TM_POOL_INDEXES / 2);
+    while(count < TM_POOL_INDEXES / 2 - 2){
+        indexes[count] = tm_alloc(size);
+        if(!indexes[count]) break;
+        tm_uint8_p(indexes[count])[0] = count;
+        count++;
+    }
+    return count;
+}
+
+int main(int argc, char *argv[]){
+    uint32_t i, sum = 0, seed = 777;
+    tm_index_t count, j;
+    double start, deref_time, defrag_time = 0;
+    uint32_t moved;
+    uint64_t moved_total = 0;
+    bool huge = (argc > 1) && !strcmp(argv[1], "huge");
+
+    if(huge && !tm_hugepage()) printf("[WARN] could not map huge pages\n");
+    tm_reset();
+    count = fill();
+
+    // random references
+    start = now_s();
+    for(i=0; i<DEREFS; i++){
+        seed = seed * 1103515245 + 12345;
+        sum += tm_uint8_p(indexes[(seed >> 8) % count])[0];
+    }
+    deref_time = now_s() - start;
+
+    // fill the pool, free every other index and do a full defrag
+    for(i=0; i<DEFRAGS; i++){
+        tm_reset();
+        count = fill();
+        for(j=0; j<count; j+=2) tm_free(indexes[j]);
+        moved = tm_pool.moved_blocks;
+        start = now_s();
+        STATUS_SET(TM_DEFRAG_FULL);
+        while(tm_thread());
+        defrag_time += now_s() - start;
+        moved_total += tm_pool.moved_blocks - moved;
+    }
+
+    printf("%s pages: pool=%ukB, references=%.1fM/s, defrag=%.2fGB/s (sum=%u)\n",
+           huge ? "huge" : "normal", (unsigned)(sizeof(tm_pool) / 1024),
+           DEREFS / deref_time / 1e6, moved_total * TM_BLOCK_SIZE / defrag_time / 1e9, sum);
+    return 0;
+}
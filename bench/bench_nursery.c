@@ -0,0 +1,68 @@
+/**
+ * Measure how much data defrag moves on a workload where most data dies
+ * young. Build it twice to compare with and without the nursery:
+ *
+ *      gcc -std=gnu99 -fgnu89-inline -O2 -Iplatform -Isrc bench/bench_nursery.c -o bench_nursery
+ *      gcc -std=gnu99 -fgnu89-inline -O2 -Iplatform -Isrc -DTM_NURSERY bench/bench_nursery.c -o bench_nursery_n
+ *
+ * The library is included directly so the pool counters can be read.
+ */
+#include "../src/tinymem.c"
+
+#define STEPS           (400000)
+#define OLD_OBJECTS     (2000)      // long lived objects
+#define YOUNG_OBJECTS   (256)       // short lived objects alive at once
+#define SURVIVE         (3)         // % of young objects that become old
+
+tm_index_t      old[OLD_OBJECTS];
+tm_index_t      young[YOUNG_OBJECTS];
+
+tm_index_t      balloc(tm_size_t size){
+    tm_index_t index;
+    if(BYTES_LEFT < size){
+        printf("[ERROR] pool is full\n");
+        exit(1);
+    }
+    index = tm_alloc(size);
+    while(!index){
+        if(!tm_thread() && !STATUS(TM_ANY_DEFRAG)) STATUS_SET(TM_DEFRAG_FULL);
+        index = tm_alloc(size);
+    }
+    return index;
+}
+
+int main(){
+    uint32_t step, i, slot, defrags = 0;
+    clock_t start;
+    tm_reset();
+    srand(777);
+    for(i=0; i<OLD_OBJECTS; i++) old[i] = balloc(16 + rand() % 112);
+
+    start = clock();
+    for(step=0; step<STEPS; step++){
+        slot = step % YOUNG_OBJECTS;
+        if(young[slot]){
+            if(rand() % 100 < SURVIVE){
+                // the young object survives and replaces a random old one
+                i = rand() % OLD_OBJECTS;
+                tm_free(old[i]);
+                old[i] = young[slot];
+            } else tm_free(young[slot]);
+        }
+        young[slot] = balloc(16 + rand() % 112);
+        tm_thread();
+        if(STATUS(TM_DEFRAG_FULL_DONE | TM_DEFRAG_FAST_DONE)){
+            STATUS_CLEAR(TM_DEFRAG_FULL_DONE | TM_DEFRAG_FAST_DONE);
+            defrags++;
+        }
+    }
+#ifdef TM_NURSERY
+    printf("nursery:    ");
+#else
+    printf("no nursery: ");
+#endif
+    printf("defrags=%u, bytes moved=%lu, time=%.3fs\n", defrags,
+           (unsigned long)tm_pool.moved_blocks * TM_BLOCK_SIZE,
+           (double)(clock() - start) / CLOCKS_PER_SEC);
+    return 0;
+}
@@ -0,0 +1,169 @@
+/**
+ * Speedup of tm_defrag_parallel with 1, 2 and 4 threads, for several fill
+ * levels and fractions of the data freed.
+ *
+ * For every case the pool is filled, the fraction is freed at random and
+ * the pool is compacted with tm_defrag_parallel. Every compaction is
+ * replayed REPLAYS times from the same seed and keeps its shortest time.
+ *
+ *      gcc -std=gnu99 -fgnu89-inline -O2 -pthread -DTM_DEFRAG_THREADS=4 -Iplatform -Isrc bench/bench_parallel.c -o bench_parallel
+ *      ./bench_parallel
+ *
+ * The pool is small, so starting a pthread costs about as much as moving
+ * the data. Every case is run twice: with the default pthreads ("start"),
+ * and with TM_THREAD_START handing the work to threads that are already
+ * running ("pool"), as a program with a job system would. Use at most one
+ * thread per core: with fewer cores the threads take turns and there is
+ * no speedup.
+ *
+ * "most" is the most speedup the regions allow, whatever the cores: the
+ * blocks copied divided by the blocks on the longest chain of regions that
+ * wait for each other.
+ *
+ * The library is included directly so the pool can be checked.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+typedef struct {
+    pthread_t       id;
+    uint8_t         slot;
+} bench_thread;
+
+bool            bench_start(bench_thread *thread, void *(*fn)(void *), void *arg);
+void            bench_join(bench_thread thread);
+
+#define TM_THREAD_TYPE                      bench_thread
+#define TM_THREAD_START(thread, fn, arg)    bench_start(thread, fn, arg)
+#define TM_THREAD_JOIN(thread)              bench_join(thread)
+
+#include "../src/tinymem.c"
+
+#define REPLAYS         (50)
+
+struct {
+    void            *(*fn)(void *);
+    void            *arg;
+    uint8_t         state;          // 0 idle, 1 has work, 2 done
+} jobs[TM_DEFRAG_THREADS];
+
+pthread_t       job_threads[TM_DEFRAG_THREADS];
+bool            use_pool;
+uint8_t         started;            // pool slots handed out by this compaction
+
+void            *job_thread(void *arg){
+    uint8_t slot = (uint8_t)(uintptr_t)arg;
+    while(1){
+        while(__atomic_load_n(&jobs[slot].state, __ATOMIC_ACQUIRE) != 1) sched_yield();
+        jobs[slot].fn(jobs[slot].arg);
+        __atomic_store_n(&jobs[slot].state, 2, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+bool            bench_start(bench_thread *thread, void *(*fn)(void *), void *arg){
+    if(!use_pool) return !pthread_create(&thread->id, NULL, fn, arg);
+    thread->slot = started++;
+    jobs[thread->slot].fn = fn;
+    jobs[thread->slot].arg = arg;
+    __atomic_store_n(&jobs[thread->slot].state, 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+void            bench_join(bench_thread thread){
+    if(!use_pool){
+        pthread_join(thread.id, NULL);
+        return;
+    }
+    while(__atomic_load_n(&jobs[thread.slot].state, __ATOMIC_ACQUIRE) != 2) sched_yield();
+    jobs[thread.slot].state = 0;
+}
+
+uint64_t        now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void            fragment(uint8_t fill, uint8_t freed){
+    tm_index_t index;
+    tm_reset();
+    while(tm_pool.filled_blocks < (uint32_t)TM_POOL_BLOCKS * fill / 100){
+        index = tm_alloc(8 + rand() % 505);
+        if(!index) break;               // out of indexes or heap
+    }
+    for(index=1; index<TM_POOL_INDEXES; index++){
+        if(FILLED(index) && rand() % 100 < freed) tm_free(index);
+    }
+}
+
+double          most_speedup(){
+    // when every region could have read and finished with as many threads
+    //      as regions
+    defrag_work work;
+    uint64_t read[DEFRAG_REGIONS], done[DEFRAG_REGIONS], ready, copied = 0, longest = 1;
+    tm_blocks_t blocks;
+    uint8_t r, dep;
+    parallel_regions(&work);
+    for(r=0; r<work.count; r++){
+        defrag_region *region = &work.regions[r];
+        blocks = (r + 1 < work.count ? region[1].dest : tm_pool.filled_blocks) - region->dest;
+        for(ready=0, dep=region->wait; dep<region->until; dep++){
+            if(read[dep] > ready) ready = read[dep];
+        }
+        if(region->head){
+            read[r] = blocks;
+            done[r] = (read[r] > ready ? read[r] : ready) + region->head;
+        } else read[r] = done[r] = ready + blocks;
+        copied += blocks + region->head;
+        if(done[r] > longest) longest = done[r];
+    }
+    return (double)copied / longest;
+}
+
+uint8_t         fills[] = {50, 90};         // % of the pool filled before freeing
+uint8_t         frees[] = {3, 12, 48};      // % of the data freed
+uint8_t         threads[] = {1, 2, 4};
+
+int main(){
+    uint64_t best, ns, one = 0;
+    double most;
+    uint8_t f, p, t, mode, r;
+    for(t=1; t<TM_DEFRAG_THREADS; t++){
+        pthread_create(&job_threads[t], NULL, job_thread, (void *)(uintptr_t)t);
+    }
+    printf("cores: %ld\n", sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-6s %5s %5s %8s %8s %8s %6s\n",
+           "mode", "fill", "freed", "threads", "us", "speedup", "most");
+    for(mode=0; mode<2; mode++){
+        use_pool = mode;
+        for(f=0; f<sizeof(fills); f++){
+            for(p=0; p<sizeof(frees); p++){
+                for(t=0; t<sizeof(threads); t++){
+                    best = UINT64_MAX;
+                    for(r=0; r<REPLAYS; r++){
+                        srand(777);
+                        fragment(fills[f], frees[p]);
+                        most = most_speedup();
+                        started = 1;
+                        ns = now_ns();
+                        tm_defrag_parallel(threads[t]);
+                        ns = now_ns() - ns;
+                        if(ns < best) best = ns;
+                        if(!pool_isvalid()){
+                            printf("[ERROR] pool is invalid after defrag\n");
+                            return 2;
+                        }
+                    }
+                    if(!t) one = best;
+                    printf("%-6s %4u%% %4u%% %8u %8.1f %8.2f %6.2f\n", mode ? "pool" : "start",
+                           fills[f], frees[p], threads[t], best / 1000.0, (double)one / best, most);
+                }
+            }
+        }
+    }
+    return 0;
+}
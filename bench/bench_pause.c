@@ -0,0 +1,120 @@
+/**
+ * Pause times of defrag: the time of every tm_thread slice while a
+ * fragmented pool is compacted, for several fill levels and block size
+ * distributions.
+ *
+ * For every case the pool is filled, a random half of the data is freed and
+ * a full defrag is run to completion with tm_thread, ROUNDS times. Reported
+ * are the slices per compaction, the total time to compact, and the p50,
+ * p99.9 and max pause.
+ *
+ * Every slice is timed once, cache misses included, with the CPU time of
+ * the thread (CLOCK_THREAD_CPUTIME_ID): time the thread was preempted for
+ * is not counted, so the pauses are those of tinymem and not of the other
+ * programs on the machine.
+ *
+ *      gcc -std=gnu99 -fgnu89-inline -O2 -Iplatform -Isrc bench/bench_pause.c -o bench_pause
+ *      ./bench_pause [budget_us]
+ *
+ * Exits with 1 if the p99.9 pause of any case is over budget_us (default
+ * TM_THREAD_TIME_US), so it can run in CI. max is only reported. A slice
+ * also finishes the block it is moving, so distributions with big blocks
+ * have longer pauses.
+ *
+ * The library is included directly so the defrag can be requested.
+ */
+#include "../src/tinymem.c"
+
+#define ROUNDS          (200)
+#define MAX_SLICES      (1 << 20)
+
+typedef tm_size_t (*distribution)();
+
+tm_size_t       small_sizes()   { return 8 + rand() % 57; }            // 8 to 64
+tm_size_t       medium_sizes()  { return 64 + rand() % 449; }          // 64 to 512
+tm_size_t       bimodal_sizes() { return rand() % 8 ? 16 : 2048; }
+tm_size_t       skewed_sizes(){
+    // mostly small, some up to 4kB: 2^(4..12) with decreasing odds
+    uint8_t shift = 4;
+    while(shift < 12 && rand() % 2) shift++;
+    return (1 << shift) + rand() % (1 << shift);
+}
+
+struct {
+    const char      *name;
+    distribution    sizes;
+} distributions[] = {
+    {"small", small_sizes},
+    {"medium", medium_sizes},
+    {"bimodal", bimodal_sizes},
+    {"skewed", skewed_sizes},
+};
+
+uint8_t         fills[] = {25, 50, 90};     // % of the pool filled before freeing
+
+uint32_t        pauses[MAX_SLICES];         // ns of every slice of a case
+
+uint64_t        now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int             compare_u32(const void *a, const void *b){
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+void            fragment(distribution sizes, uint8_t fill){
+    tm_index_t index;
+    tm_reset();
+    while(tm_pool.filled_blocks < (uint32_t)TM_POOL_BLOCKS * fill / 100){
+        index = tm_alloc(sizes());
+        if(!index) break;               // out of indexes or heap
+    }
+    for(index=1; index<TM_POOL_INDEXES; index++){
+        if(FILLED(index) && rand() % 2) tm_free(index);
+    }
+}
+
+int main(int argc, char *argv[]){
+    uint32_t budget_ns = (argc > 1 ? atoi(argv[1]) : TM_THREAD_TIME_US) * 1000;
+    uint32_t slices, round, p999;
+    uint64_t start, compact_ns;
+    uint8_t d, f;
+    bool more, failed = false;
+
+    printf("%-8s %5s %8s %12s %8s %8s %8s\n",
+           "sizes", "fill", "slices", "compact us", "p50 ns", "p99.9 ns", "max ns");
+    for(d=0; d<sizeof(distributions) / sizeof(distributions[0]); d++){
+        for(f=0; f<sizeof(fills); f++){
+            slices = 0;
+            compact_ns = 0;
+            for(round=0; round<ROUNDS; round++){
+                srand(777 + round);
+                fragment(distributions[d].sizes, fills[f]);
+                STATUS_SET(TM_DEFRAG_FULL);
+                do{
+                    start = now_ns();
+                    more = tm_thread();
+                    pauses[slices] = now_ns() - start;
+                    compact_ns += pauses[slices];
+                    if(slices < MAX_SLICES - 1) slices++;
+                }while(more);
+                if(!pool_isvalid()){
+                    printf("[ERROR] pool is invalid after defrag\n");
+                    return 2;
+                }
+            }
+            qsort(pauses, slices, sizeof(uint32_t), compare_u32);
+            p999 = pauses[(uint64_t)slices * 999 / 1000];
+            printf("%-8s %4u%% %8u %12.1f %8u %8u %8u%s\n",
+                   distributions[d].name, fills[f], slices / ROUNDS,
+                   compact_ns / 1000.0 / ROUNDS, pauses[slices / 2], p999,
+                   pauses[slices - 1], p999 > budget_ns ? "  OVER BUDGET" : "");
+            if(p999 > budget_ns) failed = true;
+        }
+    }
+    printf("budget: p99.9 <= %u ns: %s\n", budget_ns, failed ? "FAILED" : "ok");
+    return failed;
+}
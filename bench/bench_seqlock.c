@@ -0,0 +1,103 @@
+/**
+ * Read throughput of a shared pool (TM_THREADSAFE) with 1 to 8 reader
+ * threads while a writer keeps allocating, freeing and defragmenting.
+ *
+ * Readers either use the lock free read sections (tm_read_begin and
+ * tm_read_retry) or take the pool lock around every read, which is what
+ * sharing a pool needed before.
+ *
+ *      gcc -std=gnu99 -fgnu89-inline -O2 -pthread -DTM_THREADSAFE -Iplatform -Isrc bench/bench_seqlock.c -o bench_seqlock
+ *
+ * The library is included directly so the readers can take tm_lock.
+ */
+#include "../src/tinymem.c"
+
+#ifndef TM_THREADSAFE
+#error "build with -DTM_THREADSAFE"
+#endif
+
+#define INDEXES         (1024)
+#define RUN_SECONDS     (0.5)
+
+tm_index_t      shared[INDEXES];
+bool            stop;
+bool            use_lock;
+
+double          now_s(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void            *reader(void *reads){
+    uint32_t seq, i, value, sum = 0;
+    uint64_t n = 0;
+    while(!__atomic_load_n(&stop, __ATOMIC_RELAXED)){
+        for(i=0; i<INDEXES; i++){
+            if(use_lock){
+                TM_LOCK(&tm_lock);
+                value = tm_uint32_p(shared[i])[0];
+                TM_UNLOCK(&tm_lock);
+            } else{
+                do{
+                    seq = tm_read_begin();
+                    value = tm_uint32_p(shared[i])[0];
+                }while(tm_read_retry(seq));
+            }
+            sum += value;
+        }
+        n += INDEXES;
+    }
+    *(uint64_t *)reads = n + (sum == 42);
+    return NULL;
+}
+
+void            *writer(void *unused){
+    // churn short lived data so that tm_thread keeps moving the shared data
+    tm_index_t churn[64] = {0};
+    uint32_t i = 0;
+    while(!__atomic_load_n(&stop, __ATOMIC_RELAXED)){
+        tm_free(churn[i % 64]);
+        churn[i % 64] = tm_alloc(16 + i % 128);
+        if(!(i % 64)) STATUS_SET(TM_DEFRAG_FULL);
+        tm_thread();
+        i++;
+    }
+    return NULL;
+}
+
+int main(){
+    pthread_t threads[8], write_thread;
+    uint64_t reads[8], total;
+    uint8_t t, nthreads, mode;
+    double start;
+    uint32_t i;
+    tm_reset();
+    for(i=0; i<INDEXES; i++){
+        tm_alloc(8 + i % 32);       // leave holes under the shared data
+        shared[i] = tm_alloc(16);
+        tm_uint32_p(shared[i])[0] = i;
+    }
+
+    printf("%-8s %-14s %12s\n", "readers", "reads", "Mreads/s");
+    for(mode=0; mode<2; mode++){
+        use_lock = mode;
+        for(nthreads=1; nthreads<=8; nthreads*=2){
+            stop = false;
+            pthread_create(&write_thread, NULL, writer, NULL);
+            for(t=0; t<nthreads; t++) pthread_create(&threads[t], NULL, reader, &reads[t]);
+            start = now_s();
+            while(now_s() - start < RUN_SECONDS);
+            __atomic_store_n(&stop, true, __ATOMIC_RELAXED);
+            total = 0;
+            for(t=0; t<nthreads; t++){
+                pthread_join(threads[t], NULL);
+                total += reads[t];
+            }
+            pthread_join(write_thread, NULL);
+            printf("%-8u %-14s %12.1f\n", nthreads, use_lock ? "pool lock" : "read section",
+                   total / (now_s() - start) / 1e6);
+        }
+    }
+    return 0;
+}
@@ -1,3 +1,5 @@
+import os
+import subprocess
 import pymakec as mk
 
 
@@ -6,7 +8,32 @@ sources = mk.sourcefiles(directories)
 directories.append('tests')
 tests = mk.sourcefiles('tests')
 
+# the C++ headers are tested by tests/cpp, built against the C library
+CC = os.environ.get('CC', 'gcc')
+CXX = os.environ.get('CXX', 'g++')
+CPP_BUILD = '_cpp_build'
+
+
+def cpp_tests():
+    includes = ['-Iplatform', '-Isrc']
+    objects = []
+    os.makedirs(CPP_BUILD, exist_ok=True)
+    for source in sorted(os.listdir('src')):
+        if not source.endswith('.c'):
+            continue
+        objects.append(os.path.join(CPP_BUILD, source + '.o'))
+        subprocess.check_call([CC, '-std=gnu99', '-fgnu89-inline', '-O2'] + includes
+                              + ['-c', os.path.join('src', source), '-o', objects[-1]])
+    cpp_sources = sorted(os.path.join('tests', 'cpp', f) for f in os.listdir(os.path.join('tests', 'cpp'))
+                         if f.endswith('.cpp'))
+    binary = os.path.join(CPP_BUILD, 'test_cpp')
+    subprocess.check_call([CXX, '-std=c++20', '-O2', '-Wall'] + includes + cpp_sources + objects
+                          + ['-pthread', '-o', binary])
+    subprocess.check_call([binary])
+
+
 if __name__ == '__main__':
     mk.compile(directories, sources, tests,
                clean=mk.cleanfiles(directories))
     mk.runtests('tests')
+    cpp_tests()
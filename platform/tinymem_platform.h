@@ -28,6 +28,17 @@
 #include "time.h"
 #define CPU_CLOCKS_PER_SEC      (700000000uL)     // Defined at 700MHz for general
 
+/**
+ * \brief           Monotonic time in nanoseconds (optional)
+ *                  Used by tm_alloc_wait. If not defined, clock() is used
+ */
+#define TM_TIME_NS()            tm_linux_time_ns()
+static inline unsigned long long tm_linux_time_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
 /*---------------------------------------------------------------------------*/
 /**
  * \brief           Max time allowed per run of the thread (in microseconds)
@@ -117,7 +128,251 @@
 #define TM_DEFRAG_INDEXES       90      // trigger at this % used indexes
 #define TM_DEFRAG_MIN           2       // Minimum fragmentation that has to exist to operate
 
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           Large objects (optional)
+ *                  Allocations of at least TM_LARGE_SIZE bytes are not put
+ *                  in the pool. They get their own buffer from TM_LARGE_ALLOC
+ *                  and are still referenced by a tm_index_t, but tm_defrag
+ *                  never has to move them.
+ *
+ *                  TM_LARGE_INDEXES is the maximum number of large objects
+ *                  that can exist at the same time.
+ *
+ *                  tm_realloc on a large object uses TM_LARGE_REALLOC, which
+ *                  on linux will remap the pages instead of copying them.
+ */
+//#define TM_LARGE_SIZE           (16384)
+//#define TM_LARGE_INDEXES        (32)
+//#define TM_LARGE_ALLOC(size)            malloc(size)
+//#define TM_LARGE_REALLOC(ptr, size)     realloc(ptr, size)
+//#define TM_LARGE_FREE(ptr)              free(ptr)
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           Incremental integrity check (optional)
+ *                  When defined, every call to tm_thread checks TM_CHECK_STEPS
+ *                  links of the index chain, entries of the freed bins and
+ *                  words of the filled/points bit arrays, and continues where
+ *                  it stopped on the next call. Over time the whole pool is
+ *                  covered at a small fixed cost per call.
+ *
+ *                  If anything is inconsistent TM_ERROR is set in the status
+ *                  (see tm_defrag_progress).
+ */
+//#define TM_CHECK_STEPS          (4)
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           Pinned data (optional)
+ *                  When defined, tm_pin/tm_unpin mark data that defrag must
+ *                  not move. Defrag compacts the other data around it instead
+ *                  of waiting for it. Costs one more bit array of
+ *                  TM_POOL_INDEXES bits.
+ */
+//#define TM_PIN
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           Per tag accounting (optional)
+ *                  Number of tags (at most 256). When defined every index
+ *                  stores a one byte tag, set by tm_alloc_tagged, and the
+ *                  pool keeps live bytes, count, churn and defrag moves per
+ *                  tag (see tm_tag_stats).
+ */
+//#define TM_TAGS                 (16)
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           Pool counters (optional)
+ *                  When defined the pool counts the freed holes of every bin
+ *                  and keeps latency histograms of tm_alloc and tm_thread
+ *                  (two TM_TIME_NS calls each). tm_stats copies them, and
+ *                  tinymem_stats.h publishes them in shared memory for
+ *                  tools/tinymem_top.c.
+ */
+//#define TM_STATS
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           Compression of cold data (optional)
+ *                  When defined, data read with tm_access_p that wasn't
+ *                  accessed for TM_COMPRESS_CYCLES calls to tm_thread is
+ *                  compressed in place (with a built-in LZ codec) and the
+ *                  rest of its space is freed. tm_access_p decompresses it.
+ *
+ *                  Only data of TM_COMPRESS_MIN to TM_COMPRESS_MAX bytes is
+ *                  compressed, at most one index per tm_thread call, which
+ *                  looks at TM_COMPRESS_STEPS indexes. Costs a bit array and
+ *                  2 bytes per index, and a TM_COMPRESS_MAX buffer.
+ */
+//#define TM_COMPRESS
+//#define TM_COMPRESS_CYCLES      (1024)
+//#define TM_COMPRESS_MIN         (64)
+//#define TM_COMPRESS_MAX         (2048)
+//#define TM_COMPRESS_STEPS       (8)
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           Reference counts (optional)
+ *                  When defined, tm_retain and tm_release count references
+ *                  to data. Data whose last reference is released is freed
+ *                  by tm_thread, TM_REFCOUNT_BATCH indexes per call, and
+ *                  joined with its neighbours in a single pass. Costs a bit
+ *                  array and 1 byte per index.
+ */
+//#define TM_REFCOUNT
+//#define TM_REFCOUNT_BATCH       (64)
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           Parallel compaction (optional)
+ *                  Maximum number of threads of tm_defrag_parallel, which
+ *                  compacts the whole pool at once. Threads are pthreads
+ *                  unless TM_THREAD_TYPE, TM_THREAD_START(thread, fn, arg)
+ *                  (true on success) and TM_THREAD_JOIN(thread) are defined.
+ */
+//#define TM_DEFRAG_THREADS       (4)
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           Growable index table (optional)
+ *                  By default the index lookup (and its bit arrays) has
+ *                  room for all TM_POOL_INDEXES from the start. When
+ *                  TM_INDEX_CHUNK is defined only the first TM_INDEX_CHUNK
+ *                  indexes are in the pool. More chunks are allocated with
+ *                  TM_INDEX_ALLOC when the indexes run out, up to
+ *                  TM_POOL_INDEXES, and are freed by tm_reset.
+ *
+ *                  Chunks never move, so existing indexes stay valid. Every
+ *                  index lookup goes through the chunk table, which costs
+ *                  one more load.
+ */
+//#define TM_INDEX_CHUNK          (512)
+//#define TM_INDEX_ALLOC(size)            malloc(size)
+//#define TM_INDEX_FREE(ptr)              free(ptr)
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           Nursery (optional)
+ *                  When defined, a defrag requested by tm_thread or tm_alloc
+ *                  normally only compacts the nursery: the data allocated since
+ *                  the last promotion. Data that was already in the nursery at
+ *                  the previous promotion is promoted to the old region once
+ *                  TM_NURSERY_CYCLES calls to tm_thread have passed.
+ *
+ *                  The old region is only compacted when most of the freed
+ *                  data is in it, or when a nursery defrag was not enough.
+ */
+//#define TM_NURSERY
+//#define TM_NURSERY_CYCLES       (64)
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           Freed list table (optional)
+ *                  By default the links of the freed lists are stored inside
+ *                  of the freed memory, so every free touches the heap.
+ *                  When defined, they are kept in a table next to the index
+ *                  lookup instead. This costs sizeof(tm_index_t) * 2 bytes
+ *                  per index, but freed memory is never written to (and
+ *                  TM_BLOCK_SIZE may be smaller than 2 * sizeof(tm_index_t))
+ */
+//#define TM_FREED_TABLE
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           Giving memory back to the OS (optional)
+ *                  When TM_PAGE_RELEASE(ptr, bytes) is defined, tm_trim() gives
+ *                  whole unused pages of the pool back to the OS. After a full
+ *                  defrag, tm_thread does the same for the pages above the heap
+ *                  once the heap shrank by at least TM_TRIM_HYSTERESIS bytes.
+ */
+//#include <sys/mman.h>
+//#define TM_PAGE_SIZE                    (4096)
+//#define TM_PAGE_RELEASE(ptr, bytes)     madvise(ptr, bytes, MADV_DONTNEED)
+//#define TM_TRIM_HYSTERESIS              (65536)
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           Huge pages (optional)
+ *                  When TM_HUGEPAGE_SIZE is defined the pool is aligned and
+ *                  padded to whole huge pages. tm_hugepage() replaces them
+ *                  with TM_HUGEPAGE_MAP(ptr, bytes), so that referencing
+ *                  indexes and defrag moves don't miss the TLB.
+ *
+ *                  On linux MAP_HUGETLB is used if huge pages are reserved,
+ *                  otherwise the pages are anonymous with MADV_HUGEPAGE
+ *                  (transparent huge pages).
+ *
+ *                  Note: TM_PAGE_RELEASE splits up the huge pages it releases
+ */
+//#define TM_HUGEPAGE_SIZE        (2097152)
+//#define TM_HUGEPAGE_MAP(ptr, bytes)     tm_linux_hugepage(ptr, bytes)
+
+#ifdef TM_HUGEPAGE_SIZE
+#include <sys/mman.h>
+static inline int tm_linux_hugepage(void *ptr, unsigned long bytes){
+    if(mmap(ptr, bytes, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB, -1, 0) != MAP_FAILED){
+        return 1;
+    }
+    // no huge pages are reserved, use transparent huge pages
+    if(mmap(ptr, bytes, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED){
+        return 0;
+    }
+    return !madvise(ptr, bytes, MADV_HUGEPAGE);
+}
+#endif
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           Thread safety (optional)
+ *                  When defined, tm_alloc, tm_realloc, tm_free, tm_thread
+ *                  (and the other functions that change the pool) take a
+ *                  lock of TM_LOCK_TYPE. The default is a pthread mutex.
+ *
+ *                  Readers don't lock. tm_void_p is read inside of a
+ *                  tm_read_begin / tm_read_retry loop, which only repeats
+ *                  when tm_thread moved data at the same time (see tinymem.h)
+ */
+//#define TM_THREADSAFE
+//#include <pthread.h>
+//#define TM_LOCK_TYPE            pthread_mutex_t
+//#define TM_LOCK_INIT            PTHREAD_MUTEX_INITIALIZER
+//#define TM_LOCK(lock)           pthread_mutex_lock(lock)
+//#define TM_UNLOCK(lock)         pthread_mutex_unlock(lock)
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           Per thread pools (optional)
+ *                  When defined, every thread has its own pool (tm_pool is
+ *                  TM_THREAD_LOCAL) and nothing is locked. An index of
+ *                  another thread is freed with tm_free_remote, which pushes
+ *                  it on the owner's lock free queue. The owner frees the
+ *                  queued indexes in its next tm_alloc or tm_thread.
+ *
+ *                  Can't be combined with TM_THREADSAFE or TM_HUGEPAGE_SIZE
+ */
+//#define TM_THREAD_POOLS
+//#define TM_THREAD_LOCAL         __thread
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           Defrag copy kernel
+ *                  tm_defrag only ever moves data to a lower address, so it
+ *                  uses a forward copy instead of memmove. When TM_COPY_SIMD
+ *                  is defined and the compiler targets x86, the copy uses
+ *                  AVX2 or SSE2 (selected at runtime).
+ *
+ *                  Moves of at least TM_COPY_NT_SIZE bytes use non-temporal
+ *                  stores so that a large defrag doesn't flush the cache.
+ */
+#define TM_COPY_SIMD
+#define TM_COPY_NT_SIZE         (32768)
+
 #define TM_H_ATTPACKPRE         __attribute__ ((__packed__))
 #define TM_H_ATTPACKSUF
+#define TM_H_ATTALIGN(bytes)    __attribute__ ((aligned (bytes)))
 
 #endif
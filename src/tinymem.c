@@ -44,7 +44,15 @@
     typedef struct {uint32_t values[4];} TM_BLOCK_TYPE;
 #endif
 
-#if     (TM_BLOCK_SIZE < 2 * TM_INDEX_SIZE)
+#if defined(TM_COPY_SIMD) && defined(__GNUC__) && defined(__SSE2__)
+    #define TM_COPY_X86
+    #include <immintrin.h>
+#endif
+#ifndef TM_COPY_NT_SIZE
+    #define TM_COPY_NT_SIZE     (32768)
+#endif
+
+#if     (TM_BLOCK_SIZE < 2 * TM_INDEX_SIZE) && !defined(TM_FREED_TABLE)
 #error  "block size must be 2 times bigger than index size"
 #endif
 
@@ -64,6 +72,33 @@
 #error "Invalid pool ptrs size, must be divisible by int"
 #endif
 
+#ifdef TM_LARGE_SIZE
+    #ifndef TM_LARGE_INDEXES
+    #define TM_LARGE_INDEXES        (32)
+    #endif
+    #ifndef TM_LARGE_ALLOC
+    #define TM_LARGE_ALLOC(size)            malloc(size)
+    #define TM_LARGE_REALLOC(ptr, size)     realloc(ptr, size)
+    #define TM_LARGE_FREE(ptr)              free(ptr)
+    #endif
+    #if (TM_LARGE_INDEXES > TM_POOL_BLOCKS)
+    #error "TM_LARGE_INDEXES must fit in tm_blocks_t"
+    #endif
+#endif
+
+#ifdef TM_INDEX_CHUNK
+    #ifndef TM_INDEX_ALLOC
+    #define TM_INDEX_ALLOC(size)            malloc(size)
+    #define TM_INDEX_FREE(ptr)              free(ptr)
+    #endif
+    #if (TM_POOL_INDEXES % TM_INDEX_CHUNK) || (TM_INDEX_CHUNK % (8 * INTSIZE))
+    #error "TM_POOL_INDEXES must be a multiple of TM_INDEX_CHUNK, which must be a multiple of int bits"
+    #endif
+    #ifdef TM_THREAD_POOLS
+    #error "TM_INDEX_CHUNK can not be used with TM_THREAD_POOLS"
+    #endif
+#endif
+
 /*---------------------------------------------------------------------------*/
 /**
  * \brief           poolptr is used by Pool to track memory location and size
@@ -77,6 +112,8 @@ TM_H_ATTPACKPRE typedef struct {
 /**
  * \brief           free_block is stored INSIDE of freed memory as a linked list
  *                  of all freed data
+ *                  With TM_FREED_TABLE it is stored in tm_pool.freed_links
+ *                  instead, and freed memory is never touched
  */
 // TODO: packed!
 TM_H_ATTPACKPRE typedef struct {
@@ -84,8 +121,36 @@ TM_H_ATTPACKPRE typedef struct {
     tm_index_t next;
 } TM_H_ATTPACKSUF free_block;
 
+#ifdef TM_THREAD_POOLS
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           remote_queue holds indexes freed by other threads
+ *                  It is a lock free stack linked through next[index]. Other
+ *                  threads only push, the owner takes the whole stack at
+ *                  once, so there is no ABA problem.
+ */
+typedef struct {
+    tm_index_t      head;                           //!< last pushed index (atomic)
+    tm_index_t      next[TM_POOL_INDEXES];          //!< link of every pushed index
+} remote_queue;
+#endif
+
+#ifdef TM_LARGE_SIZE
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           large_block holds an object that lives outside of the pool
+ *                  LOCATION(index) of a large index is its slot in
+ *                  tm_pool.large_blocks
+ */
+typedef struct {
+    void            *ptr;
+    tm_size_t       size;
+} large_block;
+#endif
+
 
 #define CEILING(x, y)           (((x) % (y)) ? (x)/(y) + 1 : (x)/(y))
+#define MIN(x, y)               ((x) < (y) ? (x) : (y))
 #define BOOL(value)             ((value) ? 1: 0)
 
 // Used in defrag to subtract from clocks_left
@@ -113,15 +178,189 @@ TM_H_ATTPACKPRE typedef struct {
 #define TM_THREAD_TIME_US      2
 #endif
 
+#if defined(TM_PAGE_RELEASE) && !defined(TM_TRIM_HYSTERESIS)
+#define TM_TRIM_HYSTERESIS     (65536)
+#endif
+
+#if defined(TM_HUGEPAGE_SIZE) && !defined(TM_HUGEPAGE_MAP)
+#error "TM_HUGEPAGE_MAP must be defined to use huge pages"
+#endif
+
+#ifdef TM_THREADSAFE
+    #ifndef TM_LOCK_TYPE
+    #include <pthread.h>
+    #define TM_LOCK_TYPE            pthread_mutex_t
+    #define TM_LOCK_INIT            PTHREAD_MUTEX_INITIALIZER
+    #define TM_LOCK(lock)           pthread_mutex_lock(lock)
+    #define TM_UNLOCK(lock)         pthread_mutex_unlock(lock)
+    #endif
+#endif
+
+#ifndef TM_TIME_NS
+    #define TM_TIME_NS()            ((uint64_t)clock() * (1000000000uLL / CLOCKS_PER_SEC))
+#endif
+
+#ifdef TM_THREAD_POOLS
+    #if defined(TM_THREADSAFE) || defined(TM_HUGEPAGE_SIZE)
+    #error "TM_THREAD_POOLS can't be combined with TM_THREADSAFE or TM_HUGEPAGE_SIZE"
+    #endif
+    #ifndef TM_THREAD_LOCAL
+    #define TM_THREAD_LOCAL         __thread
+    #endif
+#endif
+
+#if defined(TM_STATS) && TM_STATS_BINS != FREED_BINS
+#error "TM_STATS_BINS must be the number of freed bins"
+#endif
+
+#ifdef TM_DEFRAG_THREADS
+    #ifdef TM_THREAD_POOLS
+    #error "TM_DEFRAG_THREADS can't be combined with TM_THREAD_POOLS"
+    #endif
+    #ifndef TM_THREAD_TYPE
+    #include <pthread.h>
+    #define TM_THREAD_TYPE                  pthread_t
+    #define TM_THREAD_START(thread, fn, arg)    (!pthread_create(thread, NULL, fn, arg))
+    #define TM_THREAD_JOIN(thread)          pthread_join(thread, NULL)
+    #endif
+#endif
+
+#if defined(TM_TAGS) && TM_TAGS > 256
+#error "TM_TAGS can be at most 256 (tags are stored in a byte)"
+#endif
+
+#if defined(TM_NURSERY) && !defined(TM_NURSERY_CYCLES)
+#define TM_NURSERY_CYCLES      64
+#endif
+
+#if defined(TM_REFCOUNT) && !defined(TM_REFCOUNT_BATCH)
+#define TM_REFCOUNT_BATCH       (64)
+#endif
+
+#ifdef TM_COMPRESS
+#ifndef TM_COMPRESS_CYCLES
+#define TM_COMPRESS_CYCLES      (1024)
+#endif
+#ifndef TM_COMPRESS_MIN
+#define TM_COMPRESS_MIN         (64)
+#endif
+#ifndef TM_COMPRESS_MAX
+#define TM_COMPRESS_MAX         (2048)
+#endif
+#ifndef TM_COMPRESS_STEPS
+#define TM_COMPRESS_STEPS       (8)
+#endif
+#if TM_COMPRESS_CYCLES > 65535 || TM_COMPRESS_MAX > 65535
+#error "TM_COMPRESS_CYCLES and TM_COMPRESS_MAX must fit in 16 bits"
+#endif
+#if TM_COMPRESS_MIN < 16
+#error "TM_COMPRESS_MIN must be at least 16 bytes"
+#endif
+
+/**
+ * \brief           compressed data starts with its sizes
+ */
+typedef struct {
+    uint16_t        size;           //!< bytes of the data before it was compressed
+    uint16_t        length;         //!< bytes of compressed data after the header
+} compress_header;
+#endif
+
+#ifdef TM_DEFRAG_THREADS
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           a region of the chain for tm_defrag_parallel
+ */
+#define DEFRAG_REGIONS      (TM_DEFRAG_THREADS * 8)
+
+#define REGION_WAITING      (0)     //!< not taken yet
+#define REGION_MOVING       (1)     //!< a worker is moving it
+#define REGION_READ         (2)     //!< moved, its head is still in the scratch
+#define REGION_PLACING      (3)     //!< a worker copies its head back
+#define REGION_DONE         (4)
+
+typedef struct {
+    tm_index_t      first;          //!< first index of the region
+    tm_index_t      last;           //!< last index of the region
+    tm_blocks_t     start;          //!< location where the region starts
+    tm_blocks_t     end;            //!< location where the region ends
+    tm_blocks_t     dest;           //!< location its filled data moves to
+    tm_blocks_t     head;           //!< blocks it parks in the scratch, 0 for none
+    tm_blocks_t     scratch;        //!< location of its part of the scratch
+    uint8_t         wait;           //!< first region its destination overlaps
+    uint8_t         until;          //!< region after the last one it overlaps
+    uint8_t         state;          //!< REGION_*
+} defrag_region;
+
+typedef struct {
+    defrag_region   regions[DEFRAG_REGIONS];
+    uint8_t         count;          //!< regions in use
+    uint8_t         finished;       //!< regions that are REGION_DONE
+    tm_blocks_t     parked;         //!< blocks of scratch in use
+} defrag_work;
+#endif
+
+#ifdef TM_INDEX_CHUNK
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           index_chunk holds TM_INDEX_CHUNK indexes
+ *                  The first chunk is part of the pool, the others are
+ *                  allocated with TM_INDEX_ALLOC when find_index runs out.
+ *                  Chunks are never moved, so indexes stay valid.
+ */
+typedef struct {
+    poolptr         pointers[TM_INDEX_CHUNK];
+    unsigned int    filled[TM_INDEX_CHUNK / (8 * INTSIZE)];
+    unsigned int    points[TM_INDEX_CHUNK / (8 * INTSIZE)];
+#ifdef TM_FREED_TABLE
+    free_block      freed_links[TM_INDEX_CHUNK];
+#endif
+#ifdef TM_LARGE_SIZE
+    unsigned int    large[TM_INDEX_CHUNK / (8 * INTSIZE)];
+#endif
+#ifdef TM_PIN
+    unsigned int    pinned[TM_INDEX_CHUNK / (8 * INTSIZE)];
+#endif
+#ifdef TM_PAGE_RELEASE
+    unsigned int    trimmed[TM_INDEX_CHUNK / (8 * INTSIZE)];
+#endif
+#ifdef TM_TAGS
+    tm_tag_t        tags[TM_INDEX_CHUNK];
+#endif
+#ifdef TM_COMPRESS
+    unsigned int    compressed[TM_INDEX_CHUNK / (8 * INTSIZE)];
+    uint16_t        touched[TM_INDEX_CHUNK];
+#endif
+#ifdef TM_REFCOUNT
+    uint8_t         refs[TM_INDEX_CHUNK];
+    unsigned int    released[TM_INDEX_CHUNK / (8 * INTSIZE)];
+#endif
+} index_chunk;
+
+#define INDEX_CHUNKS        (TM_POOL_INDEXES / TM_INDEX_CHUNK)
+#endif
+
 /*---------------------------------------------------------------------------*/
 /**
  * \brief           Initialize (reset) the pool
  */
-#define tm_init()  ((Pool) {                                    \
+#ifndef TM_INDEX_CHUNK
+#define INIT_INDEXES                                            \
     .filled = {1},                      /*NULL is taken*/       \
     .points = {1},                      /*NULL is taken*/       \
-    .pointers = {{0, 0}},               /*heap = 0*/            \
+    .pointers = {{0, 0}},               /*heap = 0*/
+#else
+#define INIT_INDEXES                                            \
+    .index0 = {.filled = {1}, .points = {1}},                   \
+    .chunks = {&tm_pool.index0},                                \
+    .ptrs_capacity = TM_INDEX_CHUNK,
+#endif
+
+#define tm_init()  ((Pool) {                                    \
+    INIT_INDEXES                                                \
     .freed = {0},                                               \
+    .freed_used = 0,                                            \
+    .freed_max = {0},                                           \
     .filled_blocks = 0,                                         \
     .freed_blocks = 0,                                          \
     .ptrs_filled = 1,                    /*NULL is "filled"*/   \
@@ -142,10 +381,21 @@ TM_H_ATTPACKPRE typedef struct {
  */
 typedef struct {
     TM_BLOCK_TYPE   pool[TM_POOL_BLOCKS];           //!< Actual memory pool (very large)
+#ifndef TM_INDEX_CHUNK
     unsigned int    filled[MAX_BIT_INDEXES];     //!< bit array of filled pointers (only used, not freed)
     unsigned int    points[MAX_BIT_INDEXES];     //!< bit array of used pointers (both used and freed)
     poolptr         pointers[TM_POOL_INDEXES];     //!< This is the index lookup location
+#else
+    index_chunk     index0;                         //!< the first indexes (see index_chunk)
+    index_chunk     *chunks[INDEX_CHUNKS];          //!< index lookup, filled and points by chunk
+    uint32_t        ptrs_capacity;                  //!< indexes in the allocated chunks
+#endif
     tm_index_t      freed[FREED_BINS];           //!< binned storage of all freed indexes
+    uint16_t        freed_used;                     //!< bit array of the freed bins that are not empty
+    tm_blocks_t     freed_max[FREED_BINS];          //!< size of the largest index in each bin
+#if defined(TM_FREED_TABLE) && !defined(TM_INDEX_CHUNK)
+    free_block      freed_links[TM_POOL_INDEXES];   //!< freed linked list, parallel to pointers
+#endif
     tm_blocks_t     filled_blocks;                //!< total amount of data allocated
     tm_blocks_t     freed_blocks;                 //!< total amount of data freed
     tm_index_t      ptrs_filled;                    //!< total amount of pointers allocated
@@ -156,27 +406,169 @@ typedef struct {
     uint8_t         status;                         //!< status byte. Access with Pool_status macros
     tm_index_t      defrag_index;                   //!< used during defrag
     tm_index_t      defrag_prev;                    //!< used during defrag
+#ifdef TM_NURSERY
+    tm_index_t      nursery_prev;                   //!< last index of the old region
+    tm_index_t      nursery_next;                   //!< last index at the previous promotion
+    tm_blocks_t     nursery_loc;                    //!< location where the nursery starts
+    tm_blocks_t     old_freed_blocks;               //!< data freed in the old region since full defrag
+    uint16_t        nursery_cycles;                 //!< tm_thread calls since last promotion
+#endif
+#ifdef TM_PAGE_RELEASE
+    tm_blocks_t     heap_max;                       //!< highest heap since the last trim
+#ifndef TM_INDEX_CHUNK
+    unsigned int    trimmed[MAX_BIT_INDEXES];       //!< bit array of freed indexes whose pages are released
+#endif
+#endif
+#ifdef TM_TOOLS
+    uint32_t        moved_blocks;                   //!< total amount of data moved by defrag
+#endif
+#if defined(TM_PIN) && !defined(TM_INDEX_CHUNK)
+    unsigned int    pinned[MAX_BIT_INDEXES];        //!< bit array of indexes that defrag must not move
+#endif
+#ifdef TM_STATS
+    tm_index_t      freed_count[FREED_BINS];        //!< indexes in every freed bin
+    tm_blocks_t     freed_bin_blocks[FREED_BINS];   //!< blocks in every freed bin
+    uint32_t        alloc_ns[TM_STATS_BUCKETS];     //!< see tm_stats_t
+    uint32_t        thread_ns[TM_STATS_BUCKETS];
+#endif
+#ifdef TM_TAGS
+#ifndef TM_INDEX_CHUNK
+    tm_tag_t        tags[TM_POOL_INDEXES];          //!< tag of every index
+#endif
+    tm_tag_t        tag;                            //!< tag of the data pool_alloc allocates
+    tm_tag_stats_t  tag_stats[TM_TAGS];             //!< counters of every tag
+#endif
+#ifdef TM_COMPRESS
+#ifndef TM_INDEX_CHUNK
+    unsigned int    compressed[MAX_BIT_INDEXES];    //!< bit array of indexes whose data is compressed
+    uint16_t        touched[TM_POOL_INDEXES];       //!< epoch of the last tm_access_p, 0 if never
+#endif
+    uint16_t        epoch;                          //!< counts tm_thread calls, never 0
+    tm_index_t      compress_index;                 //!< next index of the chain to look at
+    uint8_t         compress_buffer[TM_COMPRESS_MAX];   //!< compressed data while it is copied
+#endif
+#ifdef TM_REFCOUNT
+#ifndef TM_INDEX_CHUNK
+    uint8_t         refs[TM_POOL_INDEXES];          //!< references of every index after the first
+    unsigned int    released[MAX_BIT_INDEXES];      //!< bit array of indexes that wait to be freed
+#endif
+    tm_index_t      ptrs_released;                  //!< total amount of indexes that wait to be freed
+    uint32_t        release_word;                   //!< next word of released to look at
+#endif
+#ifdef TM_CHECK_STEPS
+    tm_index_t      check_index;                    //!< next index of the chain to check
+    tm_index_t      check_freed;                    //!< next index of check_bin to check
+    uint8_t         check_bin;                      //!< freed bin that is being checked
+    uint32_t        check_word;                     //!< next word of the bit arrays to check
+#endif
+#ifdef TM_THREAD_POOLS
+    remote_queue    remote;                         //!< indexes freed by other threads
+#endif
+#ifdef TM_LARGE_SIZE
+#ifndef TM_INDEX_CHUNK
+    unsigned int    large[MAX_BIT_INDEXES];         //!< bit array of indexes that are large objects
+#endif
+    large_block     large_blocks[TM_LARGE_INDEXES]; //!< storage of the large objects
+    tm_index_t      ptrs_large;                     //!< total amount of large objects
+#endif
 } Pool;
 
+#ifdef TM_THREAD_POOLS
+TM_THREAD_LOCAL Pool tm_pool = tm_init();  // every thread has its own pool
+#elif !defined(TM_HUGEPAGE_SIZE)
 Pool tm_pool = tm_init();  // holds all allocations, deallocates and pretty much everything else
+#else
+// The pool is padded to whole huge pages so they can be remapped by tm_hugepage
+#define tm_pool     (tm_pool_pages.pool)
+union {
+    Pool            pool;
+    uint8_t         pages[CEILING(sizeof(Pool), TM_HUGEPAGE_SIZE) * TM_HUGEPAGE_SIZE];
+} TM_H_ATTALIGN(TM_HUGEPAGE_SIZE) tm_pool_pages = {.pool = tm_init()};
+#endif
+
+
+#ifdef TM_THREADSAFE
+uint32_t        tm_seq = 0;                 // odd while tm_thread is moving data
+TM_LOCK_TYPE    tm_lock = TM_LOCK_INIT;     // held by functions that change the pool
+#endif
 
 
 /*---------------------------------------------------------------------------*/
 /*      Local Functions Declarations                                         */
 
+tm_index_t      pool_alloc(tm_size_t size);
+tm_index_t      pool_realloc(tm_index_t index, tm_size_t size);
+void            pool_free(const tm_index_t index);
+bool            index_free(const tm_index_t index);
+inline bool     pool_thread();
 inline bool     tm_defrag();
+void            defrag_target(const tm_blocks_t blocks, const uint64_t deadline);
 tm_index_t      find_index();
+tm_index_t      realloc_index(tm_index_t index, tm_size_t size);
+#ifdef TM_STATS
+static inline void stats_record(uint32_t *histogram, uint64_t ns);
+#endif
+#ifdef TM_DEFRAG_THREADS
+bool            parallel_regions(defrag_work *work);
+void            *parallel_worker(void *arg);
+bool            parallel_ready(defrag_work *work, const defrag_region *region);
+void            parallel_move(const defrag_region *region);
+void            parallel_relink();
+#endif
+#ifdef TM_TAGS
+static inline tm_index_t tag_alloc(const tm_index_t index);
+static inline void tag_free(const tm_index_t index);
+#endif
+#ifdef TM_CHECK_STEPS
+void            check_step();
+#endif
+#ifdef TM_COMPRESS
+void            compress_step();
+bool            index_compress(const tm_index_t index);
+bool            index_decompress(const tm_index_t index);
+void            index_swap(const tm_index_t a, const tm_index_t b);
+static inline compress_header compressed_header(const tm_index_t index);
+uint16_t        lz_compress(const uint8_t *in, const uint16_t bytes, uint8_t *out, const uint16_t max);
+uint16_t        lz_decompress(const uint8_t *in, const uint16_t length, uint8_t *out, const uint16_t max);
+#endif
+#ifdef TM_REFCOUNT
+void            release_drain();
+#endif
+#ifdef TM_INDEX_CHUNK
+tm_index_t      index_grow();
+#endif
 uint8_t         freed_bin(const tm_blocks_t blocks);
 uint8_t         freed_bin_get(const tm_blocks_t blocks);
 inline void     freed_remove(const tm_index_t index);
 inline void     freed_insert(const tm_index_t index);
+tm_blocks_t     freed_max_find(const uint8_t bin, const tm_blocks_t bound);
+tm_blocks_t     freed_largest();
 tm_index_t      freed_get(const tm_blocks_t size);
 
 void index_extend(const tm_index_t index, const tm_blocks_t blocks, const bool filled);
 void index_remove(const tm_index_t index, const tm_index_t prev_index, const bool defrag);
 inline void index_join(const tm_index_t index, const tm_index_t with_index, int32_t *clocks_left);
 bool index_split(const tm_index_t index, const tm_blocks_t blocks, tm_index_t new_index);
+#ifdef TM_FREED_TABLE
+#define free_p(index)  (&INDEX_TABLE(freed_links, index))
+#else
 #define free_p(index)  ((free_block *)tm_void_p(index))
+#endif
+void            mem_move_down(void *to, const void *from, const tm_size_t bytes);
+#ifdef TM_PAGE_RELEASE
+uint32_t        page_release(const uint8_t *start, const uint8_t *end);
+uint32_t        trim_tail();
+#endif
+
+#ifdef TM_THREAD_POOLS
+void            remote_drain();
+#endif
+
+#ifdef TM_LARGE_SIZE
+tm_index_t      large_alloc(const tm_size_t size);
+tm_index_t      large_realloc(const tm_index_t index, const tm_size_t size);
+void            large_free(const tm_index_t index);
+#endif
 
 // For testing
 void                freed_print();
@@ -198,8 +590,13 @@ bool                check_index(tm_index_t index);
  */
 #define BLOCKS_LEFT                 (TM_POOL_BLOCKS - tm_pool.filled_blocks)
 #define BYTES_LEFT                  (BLOCKS_LEFT * TM_BLOCK_SIZE)
+#ifndef TM_LARGE_SIZE
 #define PTRS_USED                   (tm_pool.ptrs_filled + tm_pool.ptrs_freed)
 #define PTRS_LEFT                   (TM_POOL_INDEXES - tm_pool.ptrs_filled) // ptrs potentially left
+#else
+#define PTRS_USED                   (tm_pool.ptrs_filled + tm_pool.ptrs_freed + tm_pool.ptrs_large)
+#define PTRS_LEFT                   (TM_POOL_INDEXES - tm_pool.ptrs_filled - tm_pool.ptrs_large)
+#endif
 #define PTRS_AVAILABLE              (TM_POOL_INDEXES - PTRS_USED) // ptrs available for immediate use
 #define HEAP_LEFT                   (TM_POOL_BLOCKS - HEAP)
 #define HEAP_LEFT_BYTES             (HEAP_LEFT * TM_BLOCK_SIZE)
@@ -211,16 +608,59 @@ bool                check_index(tm_index_t index);
 #define STATUS_SET(name)            (tm_pool.status |= (name))
 #define STATUS_CLEAR(name)          (tm_pool.status &= ~(name))
 
+/**
+ * \brief           Writers hold the pool lock. SEQ_BEGIN/SEQ_END are around
+ *                  every move of data (see tm_read_begin)
+ */
+#ifdef TM_THREADSAFE
+#define WRITE_LOCK()                TM_LOCK(&tm_lock)
+#define WRITE_UNLOCK()              TM_UNLOCK(&tm_lock)
+#define SEQ_BEGIN()                 do{                                         \
+        __atomic_store_n(&tm_seq, tm_seq + 1, __ATOMIC_RELAXED);                \
+        __atomic_thread_fence(__ATOMIC_RELEASE);                                \
+    }while(0)
+#define SEQ_END()                   __atomic_store_n(&tm_seq, tm_seq + 1, __ATOMIC_RELEASE)
+#else
+#define WRITE_LOCK()                do{}while(0)
+#define WRITE_UNLOCK()              do{}while(0)
+#define SEQ_BEGIN()                 do{}while(0)
+#define SEQ_END()                   do{}while(0)
+#endif
+
+/**
+ * \brief           Request a defrag because memory or indexes ran out
+ *                  With a nursery, only the nursery is compacted unless a
+ *                  nursery defrag already wasn't enough or most of the freed
+ *                  data is in the old region
+ */
+#ifdef TM_NURSERY
+#define DEFRAG_REQUEST()            STATUS_SET((STATUS(TM_DEFRAG_FAST_DONE) ||                      \
+                                        (uint32_t)tm_pool.old_freed_blocks * 2 > tm_pool.freed_blocks) \
+                                        ? TM_DEFRAG_FULL : TM_DEFRAG_FAST)
+#else
+#define DEFRAG_REQUEST()            STATUS_SET(TM_DEFRAG_FAST)
+#endif
+
 /*---------------------------------------------------------------------------*/
 /**
  * \brief           Access index characteristics
  */
-#define LOCATION(index)             (tm_pool.pointers[index].loc)
-#define HEAP                        (tm_pool.pointers[0].loc)
-#define NEXT(index)                 (tm_pool.pointers[index].next)
+#ifndef TM_INDEX_CHUNK
+#define INDEX_TABLE(table, index)   (tm_pool.table[index])
+#define INDEX_BITS(bits, index)     (tm_pool.bits[BITARRAY_INDEX(index)])
+#define PTRS_CAPACITY               (TM_POOL_INDEXES)
+#else
+#define INDEX_TABLE(table, index)   (tm_pool.chunks[(index) / TM_INDEX_CHUNK]->table[(index) % TM_INDEX_CHUNK])
+#define INDEX_BITS(bits, index)     (tm_pool.chunks[(index) / TM_INDEX_CHUNK]->bits[            \
+                                        BITARRAY_INDEX((index) % TM_INDEX_CHUNK)])
+#define PTRS_CAPACITY               (tm_pool.ptrs_capacity)
+#endif
+#define LOCATION(index)             (INDEX_TABLE(pointers, index).loc)
+#define HEAP                        (INDEX_TABLE(pointers, 0).loc)
+#define NEXT(index)                 (INDEX_TABLE(pointers, index).next)
 #define FREE_NEXT(index)            ((free_p(index))->next)
 #define FREE_PREV(index)            ((free_p(index))->prev)
-#define BLOCKS(index)               ((tm_blocks_t) (LOCATION(tm_pool.pointers[index].next) - \
+#define BLOCKS(index)               ((tm_blocks_t) (LOCATION(NEXT(index)) - \
                                         LOCATION(index)))       // sizeof index in blocks
 #define LOC_VOID(loc)               ((void*)(tm_pool.pool + (loc)))
 
@@ -240,36 +680,461 @@ bool                check_index(tm_index_t index);
  */
 #define BITARRAY_INDEX(index)       ((index) / (sizeof(int) * 8))
 #define BITARRAY_BIT(index)         (1 << ((index) % (sizeof(int) * 8)))
-#define FILLED(index)               (tm_pool.filled[BITARRAY_INDEX(index)] &   BITARRAY_BIT(index))
-#define FILLED_SET(index)           (tm_pool.filled[BITARRAY_INDEX(index)] |=  BITARRAY_BIT(index))
-#define FILLED_CLEAR(index)         (tm_pool.filled[BITARRAY_INDEX(index)] &= ~BITARRAY_BIT(index))
-#define POINTS(index)               (tm_pool.points[BITARRAY_INDEX(index)] &   BITARRAY_BIT(index))
-#define POINTS_SET(index)           (tm_pool.points[BITARRAY_INDEX(index)] |=  BITARRAY_BIT(index))
-#define POINTS_CLEAR(index)         (tm_pool.points[BITARRAY_INDEX(index)] &= ~BITARRAY_BIT(index))
+#define FILLED(index)               (INDEX_BITS(filled, index) &   BITARRAY_BIT(index))
+#define FILLED_SET(index)           (INDEX_BITS(filled, index) |=  BITARRAY_BIT(index))
+#define FILLED_CLEAR(index)         (INDEX_BITS(filled, index) &= ~BITARRAY_BIT(index))
+#define POINTS(index)               (INDEX_BITS(points, index) &   BITARRAY_BIT(index))
+#define POINTS_SET(index)           (INDEX_BITS(points, index) |=  BITARRAY_BIT(index))
+#define POINTS_CLEAR(index)         (INDEX_BITS(points, index) &= ~BITARRAY_BIT(index))
+#define LARGE(index)                (INDEX_BITS(large, index) &   BITARRAY_BIT(index))
+#define LARGE_SET(index)            (INDEX_BITS(large, index) |=  BITARRAY_BIT(index))
+#define LARGE_CLEAR(index)          (INDEX_BITS(large, index) &= ~BITARRAY_BIT(index))
+#define PINNED(index)               (INDEX_BITS(pinned, index) &   BITARRAY_BIT(index))
+#define PINNED_SET(index)           (INDEX_BITS(pinned, index) |=  BITARRAY_BIT(index))
+#define PINNED_CLEAR(index)         (INDEX_BITS(pinned, index) &= ~BITARRAY_BIT(index))
+#define TRIMMED(index)              (INDEX_BITS(trimmed, index) &   BITARRAY_BIT(index))
+#define TRIMMED_SET(index)          (INDEX_BITS(trimmed, index) |=  BITARRAY_BIT(index))
+#define TRIMMED_CLEAR(index)        (INDEX_BITS(trimmed, index) &= ~BITARRAY_BIT(index))
+#define COMPRESSED(index)           (INDEX_BITS(compressed, index) &   BITARRAY_BIT(index))
+#define COMPRESSED_SET(index)       (INDEX_BITS(compressed, index) |=  BITARRAY_BIT(index))
+#define COMPRESSED_CLEAR(index)     (INDEX_BITS(compressed, index) &= ~BITARRAY_BIT(index))
+#define LARGE_BLOCK(index)          (tm_pool.large_blocks[LOCATION(index)])
+#define TAG(index)                  (INDEX_TABLE(tags, index))
+#define TOUCHED(index)              (INDEX_TABLE(touched, index))
+// tm_access_p touches data without the pool lock
+#define TOUCHED_LOAD(index)         __atomic_load_n(&TOUCHED(index), __ATOMIC_RELAXED)
+#define REFS(index)                 (INDEX_TABLE(refs, index))
+#define RELEASED(index)             (INDEX_BITS(released, index) &   BITARRAY_BIT(index))
+#define RELEASED_SET(index)         (INDEX_BITS(released, index) |=  BITARRAY_BIT(index))
+#define RELEASED_CLEAR(index)       (INDEX_BITS(released, index) &= ~BITARRAY_BIT(index))
+
+/**
+ * \brief           Newly allocated data is counted for tm_pool.tag
+ */
+#ifdef TM_TAGS
+#define ALLOCATED(index)            tag_alloc(index)
+#else
+#define ALLOCATED(index)            (index)
+#endif
 
 
 /*---------------------------------------------------------------------------*/
 /*      Global Function Definitions                                          */
 
 inline void tm_reset(){
+#ifdef TM_LARGE_SIZE
+    tm_blocks_t slot;
+#endif
+#ifdef TM_INDEX_CHUNK
+    tm_index_t chunk;
+#endif
+    WRITE_LOCK();
+#ifdef TM_INDEX_CHUNK
+    for(chunk=1; chunk<INDEX_CHUNKS; chunk++){
+        if(tm_pool.chunks[chunk]) TM_INDEX_FREE(tm_pool.chunks[chunk]);
+    }
+#endif
+#ifdef TM_LARGE_SIZE
+    for(slot=0; slot<TM_LARGE_INDEXES; slot++){
+        if(tm_pool.large_blocks[slot].ptr) TM_LARGE_FREE(tm_pool.large_blocks[slot].ptr);
+    }
+#endif
     tm_pool = tm_init();
+    WRITE_UNLOCK();
 }
 
+#ifdef TM_HUGEPAGE_SIZE
+/*---------------------------------------------------------------------------*/
+bool            tm_hugepage(){
+    bool mapped;
+    WRITE_LOCK();
+    mapped = TM_HUGEPAGE_MAP((void *)&tm_pool_pages, sizeof(tm_pool_pages));
+    tm_pool = tm_init();
+    WRITE_UNLOCK();
+    return mapped;
+}
+#endif
+
 /*---------------------------------------------------------------------------*/
 inline tm_size_t tm_sizeof(const tm_index_t index){
+#ifdef TM_LARGE_SIZE
+    if(LARGE(index)) return LARGE_BLOCK(index).size;
+#endif
+#ifdef TM_COMPRESS
+    if(COMPRESSED(index)) return compressed_header(index).size;
+#endif
     return BLOCKS(index) * TM_BLOCK_SIZE;
 }
 
 /*---------------------------------------------------------------------------*/
 void *          tm_void_p(const tm_index_t index){
+#ifdef TM_LARGE_SIZE
+    if(LARGE(index)) return LARGE_BLOCK(index).ptr;
+#endif
+#ifdef TM_COMPRESS
+    if(COMPRESSED(index)) return NULL;      // see tm_access_p
+#endif
     // Note: index 0 has location == heap (it is where Pool_heap is stored)
     if(LOCATION(index) >= HEAP) return NULL;
     return tm_pool.pool + LOCATION(index);
 }
 
 /*---------------------------------------------------------------------------*/
+/*      The functions that change the pool take the writer lock and call     */
+/*      pool_*, which never call the public functions themselves             */
 tm_index_t      tm_alloc(tm_size_t size){
     tm_index_t index;
+#ifdef TM_STATS
+    uint64_t start = TM_TIME_NS();
+#endif
+    WRITE_LOCK();
+    index = pool_alloc(size);
+#ifdef TM_STATS
+    stats_record(tm_pool.alloc_ns, TM_TIME_NS() - start);
+#endif
+    WRITE_UNLOCK();
+    return index;
+}
+
+tm_index_t      tm_alloc_wait(tm_size_t size, const uint32_t budget_ns, uint32_t *spent_ns){
+    uint64_t start = TM_TIME_NS(), now = start;
+    tm_index_t index;
+    uint8_t requests = STATUS(TM_DEFRAG_FULL | TM_DEFRAG_FAST);
+    bool targeted = false;  // this call started a defrag of the cheapest window
+    bool full = false;      // this call started a full defrag
+    bool pooled = true;     // defrag can't help the large objects
+#ifdef TM_LARGE_SIZE
+    pooled = size < TM_LARGE_SIZE;
+#endif
+    WRITE_LOCK();
+    index = pool_alloc(size);
+    while(!index && pooled && now - start < budget_ns && BLOCKS_LEFT >= ALIGN_BLOCKS(size)){
+        if(!STATUS(TM_DEFRAG_IP)){
+            if(full) break;     // and still didn't make enough room
+            if(!targeted){
+                defrag_target(ALIGN_BLOCKS(size), start + budget_ns);
+                targeted = true;
+            } else{
+                // the window was pinned in or the indexes ran out
+                STATUS_SET(TM_DEFRAG_FULL);
+                full = true;
+            }
+        }
+        tm_defrag();
+        // the freed data joins up as defrag goes, so the allocation can
+        //      succeed long before the defrag is done
+        index = pool_alloc(size);
+        now = TM_TIME_NS();
+    }
+    if(index && (targeted || full)){
+        // there is room now, the rest of the pool doesn't have to move
+        if(STATUS(TM_DEFRAG_IP)){
+            // the next slice would have joined the hole it is at
+            if(!FILLED(tm_pool.defrag_index) && !FILLED(NEXT(tm_pool.defrag_index))){
+                index_join(tm_pool.defrag_index, NEXT(tm_pool.defrag_index), NULL);
+            }
+            STATUS_CLEAR(TM_DEFRAG_IP);
+            tm_pool.defrag_index = 0;
+            tm_pool.defrag_prev = 0;
+        }
+        STATUS_CLEAR((TM_DEFRAG_FULL | TM_DEFRAG_FAST) & ~requests);
+    }
+    WRITE_UNLOCK();
+    if(spent_ns) *spent_ns = (uint32_t)(TM_TIME_NS() - start);
+    return index;
+}
+
+tm_index_t      tm_realloc(tm_index_t index, tm_size_t size){
+    WRITE_LOCK();
+    index = pool_realloc(index, size);
+    WRITE_UNLOCK();
+    return index;
+}
+
+void            tm_free(const tm_index_t index){
+    WRITE_LOCK();
+    pool_free(index);
+    WRITE_UNLOCK();
+}
+
+#ifdef TM_THREAD_POOLS
+tm_owner_t      tm_owner(){
+    return (tm_owner_t)&tm_pool;
+}
+
+void            tm_free_remote(tm_owner_t owner, const tm_index_t index){
+    remote_queue *remote = &((Pool *)owner)->remote;
+    tm_index_t head;
+    if(owner == tm_owner()){
+        pool_free(index);
+        return;
+    }
+    if(!index) return;
+    head = __atomic_load_n(&remote->head, __ATOMIC_RELAXED);
+    do{
+        remote->next[index] = head;
+    }while(!__atomic_compare_exchange_n(&remote->head, &head, index, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+#endif
+
+inline bool     tm_thread(){
+    bool more;
+#ifdef TM_STATS
+    uint64_t start = TM_TIME_NS();
+#endif
+    WRITE_LOCK();
+    more = pool_thread();
+#ifdef TM_STATS
+    stats_record(tm_pool.thread_ns, TM_TIME_NS() - start);
+#endif
+    WRITE_UNLOCK();
+    return more;
+}
+
+/*---------------------------------------------------------------------------*/
+/*      Free space                                                           */
+static inline tm_blocks_t largest_free(){
+    tm_blocks_t largest = freed_largest();
+    if(PTRS_AVAILABLE && HEAP_LEFT > largest) largest = HEAP_LEFT;
+    return largest;
+}
+
+static inline uint8_t fragmentation(){
+    return BLOCKS_LEFT ? 100 - (uint32_t)largest_free() * 100 / BLOCKS_LEFT : 0;
+}
+
+uint32_t        tm_largest_free(){
+    uint32_t largest;
+    WRITE_LOCK();
+    largest = (uint32_t)largest_free() * TM_BLOCK_SIZE;
+    WRITE_UNLOCK();
+    return largest;
+}
+
+uint8_t         tm_fragmentation(){
+    uint8_t percent;
+    WRITE_LOCK();
+    percent = fragmentation();
+    WRITE_UNLOCK();
+    return percent;
+}
+
+bool            tm_can_alloc(tm_size_t size){
+    // mirrors pool_alloc without changing anything. Splitting a freed index
+    //      that is too big can still fail if there are no indexes left
+    bool fits;
+    uint8_t bin;
+    WRITE_LOCK();
+#ifdef TM_LARGE_SIZE
+    if(size >= TM_LARGE_SIZE){
+        fits = tm_pool.ptrs_large < TM_LARGE_INDEXES && PTRS_AVAILABLE;
+        WRITE_UNLOCK();
+        return fits;
+    }
+#endif
+    size = ALIGN_BLOCKS(size);
+    bin = freed_bin_get(size);
+    if(BLOCKS_LEFT < size)              fits = false;
+    else if(bin == FREED_BINS)          fits = tm_pool.freed_max[FREED_BINS-1] >= size;
+    else                                fits = tm_pool.freed_used >> bin;
+    if(!fits) fits = HEAP_LEFT >= size && PTRS_AVAILABLE;
+    WRITE_UNLOCK();
+    return fits;
+}
+
+#ifdef TM_PIN
+/*---------------------------------------------------------------------------*/
+void *          tm_pin(const tm_index_t index){
+    void *ptr;
+    WRITE_LOCK();
+    assert(FILLED(index));
+#ifdef TM_COMPRESS
+    if(COMPRESSED(index) && !index_decompress(index)){
+        WRITE_UNLOCK();
+        return NULL;
+    }
+#endif
+    PINNED_SET(index);
+    ptr = tm_void_p(index);
+    WRITE_UNLOCK();
+    return ptr;
+}
+
+void            tm_unpin(const tm_index_t index){
+    WRITE_LOCK();
+    PINNED_CLEAR(index);
+    WRITE_UNLOCK();
+}
+#endif
+
+#ifdef TM_COMPRESS
+/*---------------------------------------------------------------------------*/
+void *          tm_access_p(const tm_index_t index){
+    void *ptr = NULL;
+    uint16_t epoch = __atomic_load_n(&tm_pool.epoch, __ATOMIC_RELAXED);
+    if(!epoch) epoch = 1;       // 0 is "never"
+    if(!(__atomic_load_n(&INDEX_BITS(compressed, index), __ATOMIC_ACQUIRE) & BITARRAY_BIT(index))){
+        // most data isn't compressed, touching it doesn't need the lock
+        //      (compress_step doesn't compress data that was touched meanwhile)
+        if(TOUCHED_LOAD(index) != epoch){
+            __atomic_store_n(&TOUCHED(index), epoch, __ATOMIC_RELAXED);
+        }
+        return tm_void_p(index);
+    }
+    WRITE_LOCK();
+    if(!COMPRESSED(index) || index_decompress(index)){
+        __atomic_store_n(&TOUCHED(index), epoch, __ATOMIC_RELAXED);
+        ptr = tm_void_p(index);
+    }
+    WRITE_UNLOCK();
+    return ptr;
+}
+
+bool            tm_compressed(const tm_index_t index){
+    return COMPRESSED(index);
+}
+#endif
+
+#ifdef TM_REFCOUNT
+/*---------------------------------------------------------------------------*/
+tm_index_t      tm_retain(const tm_index_t index){
+    tm_index_t retained = 0;
+    WRITE_LOCK();
+    assert(FILLED(index) && !RELEASED(index));
+    if(REFS(index) < UINT8_MAX){
+        REFS(index)++;
+        retained = index;
+    }
+    WRITE_UNLOCK();
+    return retained;
+}
+
+bool            tm_release(const tm_index_t index){
+    bool last;
+    WRITE_LOCK();
+    assert(FILLED(index) && !RELEASED(index));
+    last = !REFS(index);
+    if(last){
+        // tm_thread frees it (see release_drain)
+        RELEASED_SET(index);
+        tm_pool.ptrs_released++;
+    } else REFS(index)--;
+    WRITE_UNLOCK();
+    return last;
+}
+
+uint16_t        tm_refs(const tm_index_t index){
+    return FILLED(index) && !RELEASED(index) ? REFS(index) + 1 : 0;
+}
+#endif
+
+#ifdef TM_STATS
+/*---------------------------------------------------------------------------*/
+void            tm_stats(tm_stats_t *stats){
+    uint8_t bin;
+    // tm_defrag_progress takes the lock itself
+    stats->progress = tm_defrag_progress();
+    WRITE_LOCK();
+    stats->pool_bytes = TM_POOL_BLOCKS * TM_BLOCK_SIZE;
+    stats->used_bytes = (uint32_t)tm_pool.filled_blocks * TM_BLOCK_SIZE;
+    stats->freed_bytes = (uint32_t)tm_pool.freed_blocks * TM_BLOCK_SIZE;
+    stats->heap_bytes = (uint32_t)HEAP_LEFT * TM_BLOCK_SIZE;
+    stats->indexes = TM_POOL_INDEXES;
+    stats->indexes_used = tm_pool.ptrs_filled - 1;      // NULL is "filled"
+#ifdef TM_LARGE_SIZE
+    stats->indexes_used += tm_pool.ptrs_large;
+#endif
+    stats->indexes_freed = tm_pool.ptrs_freed;
+    for(bin=0; bin<FREED_BINS; bin++){
+        stats->bin_count[bin] = tm_pool.freed_count[bin];
+        stats->bin_bytes[bin] = (uint32_t)tm_pool.freed_bin_blocks[bin] * TM_BLOCK_SIZE;
+    }
+    memcpy(stats->alloc_ns, tm_pool.alloc_ns, sizeof(stats->alloc_ns));
+    memcpy(stats->thread_ns, tm_pool.thread_ns, sizeof(stats->thread_ns));
+    WRITE_UNLOCK();
+}
+
+static inline void stats_record(uint32_t *histogram, uint64_t ns){
+    uint8_t bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+    histogram[bucket < TM_STATS_BUCKETS ? bucket : TM_STATS_BUCKETS - 1]++;
+}
+#endif
+
+#ifdef TM_TAGS
+/*---------------------------------------------------------------------------*/
+tm_index_t      tm_alloc_tagged(tm_size_t size, tm_tag_t tag){
+    tm_index_t index;
+    assert(tag < TM_TAGS);
+    WRITE_LOCK();
+    tm_pool.tag = tag;
+    index = pool_alloc(size);
+    tm_pool.tag = 0;
+    WRITE_UNLOCK();
+    return index;
+}
+
+tm_tag_t        tm_tag(const tm_index_t index){
+    return TAG(index);
+}
+
+tm_tag_stats_t  tm_tag_stats(tm_tag_t tag){
+    tm_tag_stats_t stats;
+    assert(tag < TM_TAGS);
+    WRITE_LOCK();
+    stats = tm_pool.tag_stats[tag];
+    WRITE_UNLOCK();
+    return stats;
+}
+
+static inline tm_index_t tag_alloc(const tm_index_t index){
+    tm_tag_stats_t *stats = &tm_pool.tag_stats[tm_pool.tag];
+    if(!index) return 0;
+    TAG(index) = tm_pool.tag;
+    stats->live_bytes += tm_sizeof(index);
+    stats->count++;
+    stats->allocs++;
+    return index;
+}
+
+static inline void tag_free(const tm_index_t index){
+    tm_tag_stats_t *stats = &tm_pool.tag_stats[TAG(index)];
+    stats->live_bytes -= tm_sizeof(index);
+    stats->count--;
+    stats->frees++;
+}
+#endif
+
+/*---------------------------------------------------------------------------*/
+tm_progress_t   tm_defrag_progress(){
+    tm_progress_t progress;
+    tm_blocks_t start = 0;
+    WRITE_LOCK();
+    progress.status = tm_pool.status;
+    progress.freed_bytes = (uint32_t)tm_pool.freed_blocks * TM_BLOCK_SIZE;
+    if(STATUS(TM_DEFRAG_IP)){
+        start = tm_pool.defrag_index ? LOCATION(tm_pool.defrag_index) : HEAP;
+    }
+#ifdef TM_NURSERY
+    else if(!STATUS(TM_DEFRAG_FULL)) start = tm_pool.nursery_loc;
+#endif
+    progress.remaining_bytes = STATUS(TM_ANY_DEFRAG) ?
+        (uint32_t)(HEAP - start) * TM_BLOCK_SIZE : 0;
+    progress.largest_free = (uint32_t)largest_free() * TM_BLOCK_SIZE;
+    progress.fragmentation = fragmentation();
+    WRITE_UNLOCK();
+    return progress;
+}
+
+/*---------------------------------------------------------------------------*/
+tm_index_t      pool_alloc(tm_size_t size){
+    tm_index_t index;
+#ifdef TM_THREAD_POOLS
+    if(__atomic_load_n(&tm_pool.remote.head, __ATOMIC_RELAXED)) remote_drain();
+#endif
+#ifdef TM_LARGE_SIZE
+    if(size >= TM_LARGE_SIZE) return ALLOCATED(large_alloc(size));
+#endif
     size = ALIGN_BLOCKS(size);  // convert from bytes to blocks
     if(BLOCKS_LEFT < size) return 0;
     index = freed_get(size);
@@ -277,81 +1142,160 @@ tm_index_t      tm_alloc(tm_size_t size){
         if(BLOCKS(index) != size){ // Split the index if it is too big
             if(!index_split(index, size, 0)){
                 // Split can fail if there are not enough pointers
-                tm_free(index);
-                STATUS_SET(TM_DEFRAG_FAST);  // need more indexes
+                //      (with tags this counts as an alloc and a free)
+                pool_free(ALLOCATED(index));
+                DEFRAG_REQUEST();  // need more indexes
                 return 0;
             }
         }
-        return index;
+        return ALLOCATED(index);
     }
     if(HEAP_LEFT < size){
-        STATUS_SET(TM_DEFRAG_FAST);  // need less fragmentation
+        DEFRAG_REQUEST();  // need less fragmentation
         return 0;
     }
     if(!PTRS_LEFT) return 0;
     index = find_index();
     if(!index){
-        STATUS_SET(TM_DEFRAG_FAST);  // need more indexes
+        DEFRAG_REQUEST();  // need more indexes
         return 0;
     }
     index_extend(index, size, true);  // extend index onto heap
-    return index;
+#ifdef TM_NURSERY
+    STATUS_CLEAR(TM_DEFRAG_FAST_DONE);  // the last nursery defrag was enough
+#endif
+    return ALLOCATED(index);
 }
 
 
 /*---------------------------------------------------------------------------*/
-tm_index_t      tm_realloc(tm_index_t index, tm_size_t size){
+tm_index_t      pool_realloc(tm_index_t index, tm_size_t size){
+#ifdef TM_TAGS
+    // the data keeps its tag wherever it ends up. If it moved, pool_alloc
+    //      and pool_free did the counting, otherwise only its size changed
     tm_index_t new_index;
-    tm_blocks_t prev_size;
-    size = ALIGN_BLOCKS(size);
+    tm_size_t prev_size;
+    if(!index || !size || !FILLED(index)) return realloc_index(index, size);
+    prev_size = tm_sizeof(index);
+    tm_pool.tag = TAG(index);
+    new_index = realloc_index(index, size);
+    tm_pool.tag = 0;
+    if(new_index == index || !new_index){
+        tm_pool.tag_stats[TAG(index)].live_bytes += tm_sizeof(index) - prev_size;
+    }
+    return new_index;
+#else
+    return realloc_index(index, size);
+#endif
+}
 
-    assert(0);  // not used currently
-    if(!index) return tm_alloc(size);
+tm_index_t      realloc_index(tm_index_t index, tm_size_t size){
+    tm_index_t new_index;
+    tm_blocks_t prev_size;
+#ifdef TM_COMPRESS
+    if(index && size && COMPRESSED(index) && !index_decompress(index)) return 0;
+#endif
+#ifdef TM_LARGE_SIZE
+    if(index && size && (LARGE(index) || size >= TM_LARGE_SIZE)){
+        return large_realloc(index, size);
+    }
+#endif
+    if(!index) return pool_alloc(size);
     if(!FILLED(index)) return 0;
     if(!size){
-        tm_free(index);
+        pool_free(index);
         return 0;
     }
+    size = ALIGN_BLOCKS(size);
     new_index = NEXT(index);
     if(!FILLED(new_index)){
         // If next index is free, always join it first
         index_join(index, new_index, NULL);
     }
     prev_size = BLOCKS(index);
-    if(size == BLOCKS(index)) return index;
+    if(size == prev_size) return index;
     if(size < prev_size){  // shrink data
         if(!index_split(index, size, 0)) return 0;
         return index;
+    } else if(!NEXT(index) && !STATUS(TM_DEFRAG_IP)
+            && HEAP_LEFT >= size - prev_size){
+        // the index is at the top of the heap, grow it in place
+        HEAP += size - prev_size;
+#ifdef TM_PAGE_RELEASE
+        if(HEAP > tm_pool.heap_max) tm_pool.heap_max = HEAP;
+#endif
+        tm_pool.filled_blocks += size - prev_size;
+        return index;
     } else{  // grow data
-        new_index = tm_alloc(size * TM_BLOCK_SIZE);
+#ifdef TM_PIN
+        if(PINNED(index)) return 0;     // its address has to stay the same
+#endif
+#ifdef TM_REFCOUNT
+        if(REFS(index)) return 0;       // the other references would be lost
+#endif
+        new_index = pool_alloc(size * TM_BLOCK_SIZE);
         if(!new_index) return 0;
         MEM_MOVE(new_index, index);
-        tm_free(index);
+        pool_free(index);
         return new_index;
     }
 }
 
 /*---------------------------------------------------------------------------*/
-void            tm_free(const tm_index_t index){
+void            pool_free(const tm_index_t index){
     if(!index) return;      // ISO requires free(NULL) be a NO-OP
+    // Join all the way up if next index is free
+    if(index_free(index) && !FILLED(NEXT(index))){
+        index_join(index, NEXT(index), NULL);
+    }
+}
+
+bool            index_free(const tm_index_t index){
+    // free the data without joining it with the freed data after it
+    //      return false if it wasn't in the pool (large objects)
+#ifdef TM_TAGS
+    tag_free(index);
+#endif
+#ifdef TM_COMPRESS
+    TOUCHED(index) = 0;
+    COMPRESSED_CLEAR(index);
+#endif
+#ifdef TM_REFCOUNT
+    REFS(index) = 0;
+    if(RELEASED(index)){
+        RELEASED_CLEAR(index);
+        tm_pool.ptrs_released--;
+    }
+#endif
+#ifdef TM_PIN
+    PINNED_CLEAR(index);
+#endif
+#ifdef TM_LARGE_SIZE
+    if(LARGE(index)){
+        large_free(index);
+        return false;
+    }
+#endif
     assert(LOCATION(index) < HEAP);
     assert(index < TM_POOL_INDEXES);
     assert(FILLED(index));
     FILLED_CLEAR(index);
+#ifdef TM_NURSERY
+    if(LOCATION(index) < tm_pool.nursery_loc){
+        tm_pool.old_freed_blocks += BLOCKS(index);
+    }
+#endif
     tm_pool.filled_blocks -= BLOCKS(index);
     tm_pool.freed_blocks += BLOCKS(index);
     tm_pool.ptrs_filled--;
     tm_pool.ptrs_freed++;
     freed_insert(index);
-    // Join all the way up if next index is free
-    if(!FILLED(NEXT(index))){
-        index_join(index, NEXT(index), NULL);
-    }
+    return true;
 }
 
 /*---------------------------------------------------------------------------*/
 bool            tm_valid(const tm_index_t index){
-    if(index >= TM_POOL_INDEXES)               return false;
+    if(index >= PTRS_CAPACITY)                 return false;
     if(LOCATION(index) >= TM_POOL_BLOCKS)          return false;
     if((!POINTS(index)) || (!FILLED(index)))    return false;
     return true;
@@ -365,27 +1309,118 @@ inline bool     tm_check(const tm_index_t index, const tm_size_t size){
 }
 
 /*---------------------------------------------------------------------------*/
-inline bool     tm_thread(){
+inline bool     pool_thread(){
+#ifdef TM_THREAD_POOLS
+    if(__atomic_load_n(&tm_pool.remote.head, __ATOMIC_RELAXED)) remote_drain();
+#endif
+#ifdef TM_REFCOUNT
+    if(tm_pool.ptrs_released) release_drain();
+#endif
+#ifdef TM_CHECK_STEPS
+    check_step();
+#endif
+#ifdef TM_NURSERY
+    if(tm_pool.nursery_cycles < UINT16_MAX) tm_pool.nursery_cycles++;
+#endif
+#ifdef TM_COMPRESS
+    if(!++tm_pool.epoch) tm_pool.epoch = 1;
+#endif
     if(STATUS(TM_ANY_DEFRAG)){
         return tm_defrag();
     }
+#ifdef TM_COMPRESS
+    compress_step();    // only when there is no defrag to do
+#endif
     if((uint32_t)HEAP * 100 / TM_POOL_BLOCKS >= TM_DEFRAG_SIZE){
         // check if there are blocks to be recovered
         if((uint32_t)tm_pool.freed_blocks * 100 / (tm_pool.filled_blocks + tm_pool.freed_blocks)
                 >= TM_DEFRAG_MIN){
-            STATUS_SET(TM_DEFRAG_FAST);
+            DEFRAG_REQUEST();
         }
         return 1;
     }
     if((uint32_t)PTRS_USED * 100 / TM_POOL_INDEXES >= TM_DEFRAG_INDEXES){
         // check if there are indexes to be recovered
         if((uint32_t)tm_pool.ptrs_freed * 100 / (tm_pool.ptrs_filled + tm_pool.ptrs_freed) >= TM_DEFRAG_MIN){
-            STATUS_SET(TM_DEFRAG_FAST);
+            DEFRAG_REQUEST();
         }
         return 1;
     }
+#ifdef TM_REFCOUNT
+    return BOOL(tm_pool.ptrs_released);     // the next batch
+#else
     return 0;   // no operations pending
+#endif
+}
+
+#ifdef TM_CHECK_STEPS
+/*---------------------------------------------------------------------------*/
+void            check_step(){
+    // Check a few links of the index chain, the freed bins and the bit arrays
+    //      and continue there on the next call. A cursor that the program
+    //      changed in the meantime (freed, removed, rebinned) starts over,
+    //      but the checks within a call see a consistent pool
+    uint8_t steps;
+    tm_index_t index, next;
+    uint32_t word;
+    for(steps=0; steps<TM_CHECK_STEPS; steps++){
+        // index chain: locations only go up and the last index is known
+        index = tm_pool.check_index;
+        if(!index || !POINTS(index)) index = tm_pool.first_index;
+#ifdef TM_LARGE_SIZE
+        // it can have been freed and reused for a large object (not in the chain)
+        else if(LARGE(index)) index = tm_pool.first_index;
+#endif
+        if(index){
+            next = NEXT(index);
+            if(next){
+                if(!POINTS(next) || LOCATION(next) < LOCATION(index)) goto error;
+            } else if(index != tm_pool.last_index || LOCATION(index) > HEAP) goto error;
+            tm_pool.check_index = next;
+        }
+
+        // freed bins: every entry is freed, in the right bin and linked both ways
+        index = tm_pool.check_freed;
+        if(!index || FILLED(index) || !POINTS(index)
+                || freed_bin(BLOCKS(index)) != tm_pool.check_bin){
+            tm_pool.check_bin = (tm_pool.check_bin + 1) % FREED_BINS;
+            index = tm_pool.freed[tm_pool.check_bin];
+            if(index && FREE_PREV(index)) goto error;
+        }
+        if(index){
+            if(FILLED(index) || !POINTS(index) || freed_bin(BLOCKS(index)) != tm_pool.check_bin){
+                goto error;
+            }
+            next = FREE_NEXT(index);
+            if(next && FREE_PREV(next) != index) goto error;
+            tm_pool.check_freed = next;
+        }
+
+        // bit arrays: only indexes that point can be filled (or large)
+        if(tm_pool.check_word >= PTRS_CAPACITY / INTBITS) tm_pool.check_word = 0;
+        word = tm_pool.check_word++ * INTBITS;
+        if(INDEX_BITS(filled, word) & ~INDEX_BITS(points, word)) goto error;
+        if(!word && !(INDEX_BITS(filled, 0) & INDEX_BITS(points, 0) & 1)) goto error;
+#ifdef TM_LARGE_SIZE
+        if(INDEX_BITS(large, word) & ~INDEX_BITS(filled, word)) goto error;
+#endif
+#ifdef TM_PIN
+        if(INDEX_BITS(pinned, word) & ~INDEX_BITS(filled, word)) goto error;
+#endif
+#ifdef TM_COMPRESS
+        if(INDEX_BITS(compressed, word) & ~INDEX_BITS(filled, word)) goto error;
+#endif
+#ifdef TM_REFCOUNT
+        if(INDEX_BITS(released, word) & ~INDEX_BITS(filled, word)) goto error;
+#endif
+    }
+    return;
+error:
+    STATUS_SET(TM_ERROR);
+    tm_pool.check_index = 0;
+    tm_pool.check_freed = 0;
 }
+#endif
 
 /*---------------------------------------------------------------------------*/
 inline bool         tm_defrag(){
@@ -398,27 +1433,76 @@ inline bool         tm_defrag(){
     tm_blocks_t blocks;
     tm_blocks_t location;
     if(!STATUS(TM_DEFRAG_IP)){
+#ifdef TM_NURSERY
+        if(!STATUS(TM_DEFRAG_FULL)){
+            // only compact the nursery. If the last old index is still filled
+            //      start right after it, otherwise walk over the old region
+            if(FILLED(tm_pool.nursery_prev)){
+                tm_pool.defrag_prev = tm_pool.nursery_prev;
+                tm_pool.defrag_index = tm_pool.nursery_prev ?
+                    NEXT(tm_pool.nursery_prev) : tm_pool.first_index;
+            } else{
+                tm_pool.defrag_prev = 0;
+                tm_pool.defrag_index = tm_pool.first_index;
+            }
+            STATUS_CLEAR(TM_ANY_DEFRAG);
+            STATUS_SET(TM_DEFRAG_FAST_IP);
+        } else
+#endif
+        {
         tm_pool.defrag_index = tm_pool.first_index;
         tm_pool.defrag_prev = 0;
         STATUS_CLEAR(TM_ANY_DEFRAG);
         STATUS_SET(TM_DEFRAG_FULL_IP);
+        }
+    } else if(tm_pool.defrag_prev){
+        // Since the last call the program can have split a hole off of
+        //      defrag_prev or freed it. Continue right after it, and if both
+        //      are holes join them so that data is never moved onto a hole
+        tm_pool.defrag_index = NEXT(tm_pool.defrag_prev);
+        if(!FILLED(tm_pool.defrag_prev) && !FILLED(tm_pool.defrag_index)){
+            index_join(tm_pool.defrag_prev, tm_pool.defrag_index, &clocks_left);
+            tm_pool.defrag_index = NEXT(tm_pool.defrag_prev);
+        }
     }
     if(!tm_pool.defrag_index) goto done;
     while(NEXT(tm_pool.defrag_index)){
-        if(!FILLED(tm_pool.defrag_index)){
+        if(!FILLED(tm_pool.defrag_index)
+#ifdef TM_NURSERY
+                && (STATUS(TM_DEFRAG_FULL_IP) || LOCATION(tm_pool.defrag_index) >= tm_pool.nursery_loc)
+#endif
+                ){
             clocks_left -= 30 + INDEX_REMOVE_CLOCKS + SPLIT_CLOCKS;
             if(!FILLED(NEXT(tm_pool.defrag_index))){
                 index_join(tm_pool.defrag_index, NEXT(tm_pool.defrag_index), &clocks_left);
                 if(clocks_left < 0) return 1;
             }
             if(!NEXT(tm_pool.defrag_index)) break;
+#ifdef TM_PIN
+            if(PINNED(NEXT(tm_pool.defrag_index))){
+                // the data can't move. Leave the hole below it (it stays in
+                //      the freed bins) and compact the data above it
+                tm_pool.defrag_prev = NEXT(tm_pool.defrag_index);
+                tm_pool.defrag_index = NEXT(tm_pool.defrag_prev);
+                if(!tm_pool.defrag_index) goto done;
+                continue;
+            }
+#endif
 
             /*DBGprintf("### Defrag: loop=%-11u", i); index_print(tm_pool.defrag_index);*/
             assert(FILLED(NEXT(tm_pool.defrag_index)));
             blocks = BLOCKS(NEXT(tm_pool.defrag_index));        // store size of actual data
             location = LOCATION(NEXT(tm_pool.defrag_index));    // location of actual data
             clocks_left -= CEILING(blocks * TM_BLOCK_SIZE, sizeof(int));
+#ifdef TM_TOOLS
+            tm_pool.moved_blocks += blocks;
+#endif
+#ifdef TM_TAGS
+            tm_pool.tag_stats[TAG(NEXT(tm_pool.defrag_index))].moved_bytes += blocks * TM_BLOCK_SIZE;
+#endif
 
+            // the data of NEXT(defrag_index) moves down until the split
+            SEQ_BEGIN();
             // Make index "filled", we will split it up later
             freed_remove(tm_pool.defrag_index);         // 7 clocks
             FILLED_SET(tm_pool.defrag_index);           // 2 clocks
@@ -436,8 +1520,8 @@ inline bool         tm_defrag(){
 
             assert(LOCATION(tm_pool.defrag_prev) < TM_POOL_BLOCKS);
             assert(location < TM_POOL_BLOCKS);
-            memmove(LOC_VOID(LOCATION(tm_pool.defrag_prev)),
-                    LOC_VOID(location), ((tm_size_t)blocks) * TM_BLOCK_SIZE);
+            mem_move_down(LOC_VOID(LOCATION(tm_pool.defrag_prev)),
+                          LOC_VOID(location), ((tm_size_t)blocks) * TM_BLOCK_SIZE);
             if(!FILLED(NEXT(tm_pool.defrag_prev))){
                 index_join(tm_pool.defrag_prev, NEXT(tm_pool.defrag_prev), &clocks_left);
             }
@@ -446,12 +1530,21 @@ inline bool         tm_defrag(){
                 assert(0);
             } // note: tm_pool.defrag_index is now invalid (split used it)
             assert(BLOCKS(tm_pool.defrag_prev) == blocks);
+            SEQ_END();
 
             tm_pool.defrag_index = NEXT(tm_pool.defrag_prev);
 
             assert(!FILLED(tm_pool.defrag_index));
 
         } else{
+#ifdef TM_NURSERY
+            // holes in the old region are left for a full defrag, but they
+            //      must be joined so that a hole never follows a hole
+            if(!FILLED(tm_pool.defrag_index) && !FILLED(NEXT(tm_pool.defrag_index))){
+                index_join(tm_pool.defrag_index, NEXT(tm_pool.defrag_index), &clocks_left);
+                if(!NEXT(tm_pool.defrag_index)) break;
+            }
+#endif
             clocks_left -= 10;
             tm_pool.defrag_prev = tm_pool.defrag_index;
             tm_pool.defrag_index = NEXT(tm_pool.defrag_index);
@@ -466,8 +1559,33 @@ done:
     if(!FILLED(tm_pool.defrag_index)){
         index_remove(tm_pool.defrag_index, tm_pool.defrag_prev, true);
     }
+#ifdef TM_NURSERY
+    if(STATUS(TM_DEFRAG_FAST_IP)){
+        STATUS_SET(TM_DEFRAG_FAST_DONE);
+    } else{
+        STATUS_CLEAR(TM_DEFRAG_FAST_DONE);
+        STATUS_SET(TM_DEFRAG_FULL_DONE);
+        tm_pool.old_freed_blocks = 0;
+        tm_pool.nursery_cycles = TM_NURSERY_CYCLES;     // old region moved, recompute it
+    }
+    if(tm_pool.nursery_cycles >= TM_NURSERY_CYCLES){
+        // promote the data that was already in the nursery at the last
+        //      promotion (it has survived a whole nursery period)
+        tm_pool.nursery_prev = tm_pool.nursery_next;
+        tm_pool.nursery_loc = tm_pool.nursery_prev ? LOCATION(NEXT(tm_pool.nursery_prev)) : 0;
+        tm_pool.nursery_next = tm_pool.last_index;
+        tm_pool.nursery_cycles = 0;
+    }
+    STATUS_CLEAR(TM_DEFRAG_IP);
+#else
     STATUS_CLEAR(TM_DEFRAG_IP);
     STATUS_SET(TM_DEFRAG_FULL_DONE);
+#endif
+#ifdef TM_PAGE_RELEASE
+    if((uint32_t)(tm_pool.heap_max - HEAP) * TM_BLOCK_SIZE >= TM_TRIM_HYSTERESIS){
+        trim_tail();
+    }
+#endif
     /*tm_debug("filled end=%lu, total=%lu, operate=%lu, isavail=%lu",*/
             /*tm_pool.filled_blocks, TM_POOL_BLOCKS, TM_POOL_BLOCKS - tm_pool.filled_blocks,*/
             /*BLOCKS_LEFT);*/
@@ -483,6 +1601,312 @@ done:
     return 0;
 }
 
+/*---------------------------------------------------------------------------*/
+void            defrag_target(const tm_blocks_t blocks, const uint64_t deadline){
+    // start a full defrag at the freed index where the least data has to
+    //      move until the freed space after it adds up to blocks (the heap
+    //      counts at the end of the chain). Walks the chain once with a
+    //      window [left, right) and its freed and filled blocks. At the
+    //      deadline it takes the best window so far, or the whole pool
+    tm_index_t left = tm_pool.first_index, right = left, prev = 0;
+    tm_index_t best = 0, best_prev = 0;
+    uint32_t freed = 0, filled = 0, best_filled = UINT32_MAX, steps = 0;
+    while(left){
+        if(!(++steps % 64) && TM_TIME_NS() >= deadline) break;
+        while(right && freed < blocks){
+            if(FILLED(right)) filled += BLOCKS(right);
+            else              freed += BLOCKS(right);
+            right = NEXT(right);
+        }
+        if(freed + (right ? 0 : HEAP_LEFT) < blocks) break;     // the windows only get smaller
+        if(!FILLED(left) && filled < best_filled){
+            best = left;
+            best_prev = prev;
+            best_filled = filled;
+        }
+        if(FILLED(left)) filled -= BLOCKS(left);
+        else             freed -= BLOCKS(left);
+        prev = left;
+        left = NEXT(left);
+    }
+    if(!best){
+        best = tm_pool.first_index;
+        best_prev = 0;
+    }
+    // tm_defrag continues from here as if it had been running
+    tm_pool.defrag_index = best;
+    tm_pool.defrag_prev = best_prev;
+    STATUS_SET(TM_DEFRAG_FULL_IP);
+}
+
+#ifdef TM_DEFRAG_THREADS
+/*---------------------------------------------------------------------------*/
+/*      Parallel compaction                                                  */
+/*      The chain is cut into regions of about the same size. A serial pass  */
+/*      computes where the data of every region goes (a prefix sum of the   */
+/*      filled blocks) and which regions its destination overlaps. A region */
+/*      can move once those have read their data, the workers always take   */
+/*      the lowest region that can. When little was freed every region      */
+/*      overlaps the one before it, which would make it serial, so some     */
+/*      regions park the head of their data (what goes below their start)   */
+/*      in the free space above the heap, move the rest right away, and     */
+/*      copy the head back once the regions below have moved. The chain is  */
+/*      relinked serially at the end.                                       */
+uint32_t        tm_defrag_parallel(uint8_t threads){
+    defrag_work work;
+    TM_THREAD_TYPE workers[TM_DEFRAG_THREADS];
+    bool started[TM_DEFRAG_THREADS] = {0};
+    tm_blocks_t freed;
+    uint8_t t;
+    if(threads > TM_DEFRAG_THREADS) threads = TM_DEFRAG_THREADS;
+    WRITE_LOCK();
+    freed = tm_pool.freed_blocks;
+    if(!parallel_regions(&work)){
+        // pinned data: compact around it with the serial defrag
+        STATUS_SET(TM_DEFRAG_FULL);
+        while(STATUS(TM_ANY_DEFRAG)) tm_defrag();
+        WRITE_UNLOCK();
+        return (uint32_t)(freed - tm_pool.freed_blocks) * TM_BLOCK_SIZE;
+    }
+#ifdef TM_PAGE_RELEASE
+    // the scratch touches pages above the heap, let the trim release them
+    if(HEAP + work.parked > tm_pool.heap_max) tm_pool.heap_max = HEAP + work.parked;
+#endif
+    SEQ_BEGIN();
+    for(t=1; t<threads; t++){
+        started[t] = TM_THREAD_START(&workers[t], parallel_worker, &work);
+    }
+    parallel_worker(&work);     // this thread works too
+    for(t=1; t<threads; t++){
+        if(started[t]) TM_THREAD_JOIN(workers[t]);
+    }
+    parallel_relink();
+    SEQ_END();
+    WRITE_UNLOCK();
+    return (uint32_t)freed * TM_BLOCK_SIZE;
+}
+
+bool            parallel_regions(defrag_work *work){
+    tm_index_t index = tm_pool.first_index, prev = 0;
+    tm_blocks_t size = CEILING(HEAP, DEFRAG_REGIONS) + 1, dest = 0, next_dest, head;
+    defrag_region *region = work->regions;
+    uint8_t wait = 0, until = 0, stride, r;
+    work->count = 0;
+    work->finished = 0;
+    work->parked = 0;
+    if(!index) return true;
+    *region = (defrag_region){.first = index, .start = LOCATION(index)};
+    for(; index; prev=index, index=NEXT(index)){
+#ifdef TM_PIN
+        if(PINNED(index)) return false;
+#endif
+        if(LOCATION(index) >= (region - work->regions + 1) * (uint32_t)size
+                && region->first != index){
+            // close the region at prev and start a new one at index
+            region->last = prev;
+            region->end = LOCATION(index);
+            region++;
+            *region = (defrag_region){.first = index, .start = LOCATION(index), .dest = dest};
+        }
+        if(FILLED(index)) dest += BLOCKS(index);
+    }
+    region->last = prev;
+    region->end = HEAP;
+    work->count = region - work->regions + 1;
+    // the data of a region moves onto the data of the regions in
+    //      [wait, until), which must have read it by then. Data only moves
+    //      down, so these are below it
+    for(r=0; r<work->count; r++){
+        region = &work->regions[r];
+        next_dest = r + 1 < work->count ? region[1].dest : dest;
+        while(work->regions[wait].end <= region->dest) wait++;
+        while(until < r && work->regions[until].start < next_dest) until++;
+        region->wait = wait;
+        region->until = until;
+    }
+    // a region that overlaps the one just below it waits for it, and a run
+    //      of those is serial. Park heads, spread over the regions (every
+    //      DEFRAG_REGIONS / TM_DEFRAG_THREADS first), while the space above
+    //      the heap lasts
+    for(stride=DEFRAG_REGIONS / TM_DEFRAG_THREADS; stride; stride/=2){
+        for(r=stride; r<work->count; r+=stride){
+            region = &work->regions[r];
+            if(region->head || region->until != r || region->wait == r) continue;
+            next_dest = r + 1 < work->count ? region[1].dest : dest;
+            head = MIN(region->start, next_dest) - region->dest;
+            if(head > HEAP_LEFT - work->parked) continue;
+            region->head = head;
+            region->scratch = HEAP + work->parked;
+            work->parked += head;
+        }
+    }
+    return true;
+}
+
+void            *parallel_worker(void *arg){
+    defrag_work *work = arg;
+    defrag_region *region;
+    uint8_t r, state;
+    while(__atomic_load_n(&work->finished, __ATOMIC_ACQUIRE) < work->count){
+        for(r=0; r<work->count; r++){
+            region = &work->regions[r];
+            state = __atomic_load_n(&region->state, __ATOMIC_ACQUIRE);
+            if(state == REGION_WAITING && (region->head || parallel_ready(work, region))
+                    && __atomic_compare_exchange_n(&region->state, &state, REGION_MOVING,
+                            false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+                parallel_move(region);
+                state = region->head ? REGION_READ : REGION_DONE;
+            } else if(state == REGION_READ && parallel_ready(work, region)
+                    && __atomic_compare_exchange_n(&region->state, &state, REGION_PLACING,
+                            false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+                memcpy(LOC_VOID(region->dest), LOC_VOID(region->scratch),
+                       (tm_size_t)region->head * TM_BLOCK_SIZE);
+                state = REGION_DONE;
+            } else continue;
+            __atomic_store_n(&region->state, state, __ATOMIC_RELEASE);
+            if(state == REGION_DONE) __atomic_fetch_add(&work->finished, 1, __ATOMIC_RELEASE);
+            break;      // the lowest regions first
+        }
+    }
+    return NULL;
+}
+
+bool            parallel_ready(defrag_work *work, const defrag_region *region){
+    uint8_t dep;
+    for(dep=region->wait; dep<region->until; dep++){
+        if(__atomic_load_n(&work->regions[dep].state, __ATOMIC_ACQUIRE) < REGION_READ) return false;
+    }
+    return true;
+}
+
+void            parallel_move(const defrag_region *region){
+    // move every run of filled data of the region with one mem_move_down,
+    //      the part that goes below region->dest + region->head to the
+    //      scratch. Only the LOCATION of the region's own indexes changes,
+    //      its last size is known from region->end
+    tm_index_t index = region->first;
+    tm_blocks_t dest = region->dest, blocks, run = 0, run_from = 0, run_to = 0, part;
+    while(1){
+        blocks = (index == region->last ? region->end : LOCATION(NEXT(index))) - LOCATION(index);
+        if(FILLED(index)){
+            if(!run){
+                run_from = LOCATION(index);
+                run_to = dest;
+            }
+            run += blocks;
+#ifdef TM_TAGS
+            if(dest != LOCATION(index)){
+                __atomic_fetch_add(&tm_pool.tag_stats[TAG(index)].moved_bytes,
+                                   blocks * TM_BLOCK_SIZE, __ATOMIC_RELAXED);
+            }
+#endif
+            LOCATION(index) = dest;
+            dest += blocks;
+        }
+        if(run && (!FILLED(index) || index == region->last)){
+            if(run_to < region->dest + region->head){
+                part = MIN(run, region->dest + region->head - run_to);
+                memcpy(LOC_VOID(region->scratch + run_to - region->dest), LOC_VOID(run_from),
+                       (tm_size_t)part * TM_BLOCK_SIZE);
+#ifdef TM_TOOLS
+                __atomic_fetch_add(&tm_pool.moved_blocks, part, __ATOMIC_RELAXED);
+#endif
+                run_from += part;
+                run_to += part;
+                run -= part;
+            }
+            if(run && run_to != run_from){
+                mem_move_down(LOC_VOID(run_to), LOC_VOID(run_from), (tm_size_t)run * TM_BLOCK_SIZE);
+#ifdef TM_TOOLS
+                __atomic_fetch_add(&tm_pool.moved_blocks, run, __ATOMIC_RELAXED);
+#endif
+            }
+            run = 0;
+        }
+        if(index == region->last) break;
+        index = NEXT(index);
+    }
+}
+
+void            parallel_relink(){
+    // drop the freed indexes from the chain (the data is packed at the
+    //      bottom now) and leave the pool as a finished full defrag does
+    tm_index_t index = tm_pool.first_index, next, prev = 0;
+    for(; index; index=next){
+        next = NEXT(index);
+        if(FILLED(index)){
+            if(prev) NEXT(prev) = index;
+            else     tm_pool.first_index = index;
+            prev = index;
+        } else{
+            POINTS_CLEAR(index);
+            tm_pool.ptrs_freed--;
+        }
+    }
+    if(prev) NEXT(prev) = 0;
+    else     tm_pool.first_index = 0;
+    tm_pool.last_index = prev;
+    HEAP = tm_pool.filled_blocks;
+    assert(!tm_pool.ptrs_freed);
+    tm_pool.freed_blocks = 0;
+    memset(tm_pool.freed, 0, sizeof(tm_pool.freed));
+    tm_pool.freed_used = 0;
+    memset(tm_pool.freed_max, 0, sizeof(tm_pool.freed_max));
+#ifdef TM_STATS
+    memset(tm_pool.freed_count, 0, sizeof(tm_pool.freed_count));
+    memset(tm_pool.freed_bin_blocks, 0, sizeof(tm_pool.freed_bin_blocks));
+#endif
+    tm_pool.defrag_index = 0;
+    tm_pool.defrag_prev = 0;
+    STATUS_CLEAR(TM_ANY_DEFRAG);
+    STATUS_SET(TM_DEFRAG_FULL_DONE);
+#ifdef TM_NURSERY
+    // everything that survived counts as old
+    STATUS_CLEAR(TM_DEFRAG_FAST_DONE);
+    tm_pool.nursery_prev = tm_pool.nursery_next = tm_pool.last_index;
+    tm_pool.nursery_loc = HEAP;
+    tm_pool.old_freed_blocks = 0;
+    tm_pool.nursery_cycles = 0;
+#endif
+#ifdef TM_CHECK_STEPS
+    tm_pool.check_index = 0;
+    tm_pool.check_freed = 0;
+#endif
+#ifdef TM_PAGE_RELEASE
+    if((uint32_t)(tm_pool.heap_max - HEAP) * TM_BLOCK_SIZE >= TM_TRIM_HYSTERESIS){
+        trim_tail();
+    }
+#endif
+}
+#endif
+
+#ifdef TM_PAGE_RELEASE
+/*---------------------------------------------------------------------------*/
+uint32_t        tm_trim(){
+    uint32_t released;
+    uint8_t bin;
+    tm_index_t index;
+    WRITE_LOCK();
+    released = trim_tail();
+    // release the inside of large freed holes, but keep their free_block.
+    //      A hole stays trimmed until it leaves its bin
+    for(bin=freed_bin(TM_PAGE_SIZE / TM_BLOCK_SIZE); bin<FREED_BINS; bin++){
+        for(index=tm_pool.freed[bin]; index; index=FREE_NEXT(index)){
+            if(TRIMMED(index)) continue;
+            TRIMMED_SET(index);
+#ifdef TM_FREED_TABLE
+            released += page_release((uint8_t *)LOC_VOID(LOCATION(index)),
+#else
+            released += page_release((uint8_t *)LOC_VOID(LOCATION(index)) + sizeof(free_block),
+#endif
+                                     (uint8_t *)LOC_VOID(LOCATION(NEXT(index))));
+        }
+    }
+    WRITE_UNLOCK();
+    return released;
+}
+#endif
+
 /*###########################################################################*/
 /*      Local Functions                                                      */
 
@@ -494,8 +1918,8 @@ tm_index_t      find_index(){
     uint8_t i;
     if(!PTRS_AVAILABLE) return 0;
     for(loop=0; loop<2; loop++){
-        for(; tm_pool.find_index < MAX_BIT_INDEXES; tm_pool.find_index++){
-            bits = tm_pool.points[tm_pool.find_index];
+        for(; tm_pool.find_index < PTRS_CAPACITY / INTBITS; tm_pool.find_index++){
+            bits = INDEX_BITS(points, tm_pool.find_index * INTBITS);
             if(bits != MAXUINT){
                 bit = 0;
                 if((bits & LOWER_MASK) == LOWER_MASK){
@@ -530,8 +1954,27 @@ found:
         }
         tm_pool.find_index = 0;
     }
+#ifdef TM_INDEX_CHUNK
+    return index_grow();
+#else
     assert(0);
+#endif
+}
+
+#ifdef TM_INDEX_CHUNK
+tm_index_t      index_grow(){
+    // every allocated index is in use, add a chunk and return its first index
+    index_chunk *chunk;
+    if(PTRS_CAPACITY == TM_POOL_INDEXES) return 0;
+    chunk = TM_INDEX_ALLOC(sizeof(index_chunk));
+    if(!chunk) return 0;
+    memset(chunk, 0, sizeof(index_chunk));
+    tm_pool.chunks[PTRS_CAPACITY / TM_INDEX_CHUNK] = chunk;
+    tm_pool.find_index = PTRS_CAPACITY / INTBITS;
+    tm_pool.ptrs_capacity += TM_INDEX_CHUNK;
+    return PTRS_CAPACITY - TM_INDEX_CHUNK;
 }
+#endif
 
 /*---------------------------------------------------------------------------*/
 /*      get the freed bin for blocks                                         */
@@ -586,6 +2029,7 @@ inline void     freed_remove(const tm_index_t index){
     // remove the index from the freed array. This doesn't do anything else
     //      It is very important that this is called BEFORE any changes
     //      to the index's size
+    uint8_t bin;
     assert(!FILLED(index));
 #ifdef TM_TESTS  // processor intensive
     /*assert(freed_isin(index));*/
@@ -595,10 +2039,23 @@ inline void     freed_remove(const tm_index_t index){
         assert(FREE_NEXT(FREE_PREV(index)) == index);
         FREE_NEXT(FREE_PREV(index)) = FREE_NEXT(index);
     } else{ // free is first element in the bin
-        assert(tm_pool.freed[freed_bin(BLOCKS(index))] == index);
-        tm_pool.freed[freed_bin(BLOCKS(index))] = FREE_NEXT(index);
+        bin = freed_bin(BLOCKS(index));
+        assert(tm_pool.freed[bin] == index);
+        tm_pool.freed[bin] = FREE_NEXT(index);
+        if(!tm_pool.freed[bin]) tm_pool.freed_used &= ~(1 << bin);
     }
     if(FREE_NEXT(index)) FREE_PREV(FREE_NEXT(index)) = FREE_PREV(index);
+#ifdef TM_PAGE_RELEASE
+    TRIMMED_CLEAR(index);   // it is split, joined, moved or used again
+#endif
+    bin = freed_bin(BLOCKS(index));
+    if(BLOCKS(index) == tm_pool.freed_max[bin]){
+        tm_pool.freed_max[bin] = freed_max_find(bin, BLOCKS(index));
+    }
+#ifdef TM_STATS
+    tm_pool.freed_count[bin]--;
+    tm_pool.freed_bin_blocks[bin] -= BLOCKS(index);
+#endif
 }
 
 
@@ -608,12 +2065,45 @@ inline void     freed_insert(const tm_index_t index){
     // Does not do ANY other record keeping (no adding ptrs, blocks, etc)
     uint8_t bin = freed_bin(BLOCKS(index));
     assert(!FILLED(index));
+#ifdef TM_PAGE_RELEASE
+    TRIMMED_CLEAR(index);   // the bins can be emptied without freed_remove
+#endif
     *free_p(index) = (free_block){.next=tm_pool.freed[bin], .prev=0};
     if(tm_pool.freed[bin]){
         // If a previous index exists, update it's previous value to be index
         FREE_PREV(tm_pool.freed[bin]) = index;
     }
     tm_pool.freed[bin] = index;
+    tm_pool.freed_used |= 1 << bin;
+    if(BLOCKS(index) > tm_pool.freed_max[bin]) tm_pool.freed_max[bin] = BLOCKS(index);
+#ifdef TM_STATS
+    tm_pool.freed_count[bin]++;
+    tm_pool.freed_bin_blocks[bin] += BLOCKS(index);
+#endif
+}
+
+
+tm_blocks_t     freed_max_find(const uint8_t bin, const tm_blocks_t bound){
+    // The largest index of the bin was removed, find the next one. No index
+    //      is bigger than bound, so the search stops at the first of that
+    //      size (the first index of the exact bins). 0 searches the bin
+    tm_index_t index;
+    tm_blocks_t largest = 0;
+    for(index=tm_pool.freed[bin]; index; index=FREE_NEXT(index)){
+        if(BLOCKS(index) == bound) return bound;
+        if(BLOCKS(index) > largest) largest = BLOCKS(index);
+    }
+    return largest;
+}
+
+
+tm_blocks_t     freed_largest(){
+    // largest freed index: the largest of the highest bin that has any
+    uint8_t bin = FREED_BINS;
+    while(bin--){
+        if(tm_pool.freed_used >> bin) return tm_pool.freed_max[bin];
+    }
+    return 0;
 }
 
 
@@ -622,7 +2112,9 @@ tm_index_t      freed_get(const tm_blocks_t blocks){
     //      index settings are automatically set to filled
     tm_index_t index;
     uint8_t bin = freed_bin_get(blocks);
+    if(!(tm_pool.freed_used >> (bin - (bin == FREED_BINS)))) return 0;
     if(bin == FREED_BINS){  // size is off the binning charts
+        if(tm_pool.freed_max[FREED_BINS-1] < blocks) return 0;
         index = tm_pool.freed[FREED_BINS-1];
         while(index){
             if(BLOCKS(index) >= blocks) goto found;
@@ -630,23 +2122,292 @@ tm_index_t      freed_get(const tm_blocks_t blocks){
         }
         // no need to return here: bin == FREED_BINS
     }
-    for(; bin<FREED_BINS; bin++){
-        index = tm_pool.freed[bin];
-        if(index){
-found:
-            assert(POINTS(index)); assert(!FILLED(index));
-            freed_remove(index);
-            FILLED_SET(index);
-            // Mark the index as filled. It is already on the indexes list
-            tm_pool.filled_blocks += BLOCKS(index);
-            tm_pool.freed_blocks -= BLOCKS(index);
-            tm_pool.ptrs_filled++;
-            tm_pool.ptrs_freed--;
-            return index;
-        }
+    for(; bin<FREED_BINS; bin++){
+        index = tm_pool.freed[bin];
+        if(index){
+found:
+            assert(POINTS(index)); assert(!FILLED(index));
+            freed_remove(index);
+            FILLED_SET(index);
+            // Mark the index as filled. It is already on the indexes list
+            tm_pool.filled_blocks += BLOCKS(index);
+            tm_pool.freed_blocks -= BLOCKS(index);
+            tm_pool.ptrs_filled++;
+            tm_pool.ptrs_freed--;
+            return index;
+        }
+    }
+    return 0;
+}
+
+
+/*---------------------------------------------------------------------------*/
+/*          Copy kernel                                                      */
+/*
+ * Defrag only moves data towards lower addresses (to < from), so a plain
+ * forward copy is overlap safe: every store lands below the next load.
+ */
+
+#ifdef TM_COPY_X86
+static inline void mem_move_tail(uint8_t *to, const uint8_t *from, tm_size_t bytes){
+    // Copy less than 64 bytes. Everything is loaded before anything is stored
+    //      so the (possibly overlapping) head and tail loads are always safe
+    __m128i a, b, c, d;
+    uint64_t qa, qb;
+    if(bytes > 32){
+        a = _mm_loadu_si128((const __m128i *)from);
+        b = _mm_loadu_si128((const __m128i *)(from + 16));
+        c = _mm_loadu_si128((const __m128i *)(from + bytes - 32));
+        d = _mm_loadu_si128((const __m128i *)(from + bytes - 16));
+        _mm_storeu_si128((__m128i *)to, a);
+        _mm_storeu_si128((__m128i *)(to + 16), b);
+        _mm_storeu_si128((__m128i *)(to + bytes - 32), c);
+        _mm_storeu_si128((__m128i *)(to + bytes - 16), d);
+    } else if(bytes > 16){
+        a = _mm_loadu_si128((const __m128i *)from);
+        b = _mm_loadu_si128((const __m128i *)(from + bytes - 16));
+        _mm_storeu_si128((__m128i *)to, a);
+        _mm_storeu_si128((__m128i *)(to + bytes - 16), b);
+    } else if(bytes >= 8){
+        memcpy(&qa, from, 8); memcpy(&qb, from + bytes - 8, 8);
+        memcpy(to, &qa, 8); memcpy(to + bytes - 8, &qb, 8);
+    } else{
+        while(bytes--) *to++ = *from++;
+    }
+}
+
+__attribute__((target("sse2")))
+void            mem_move_down_sse2(uint8_t *to, const uint8_t *from, tm_size_t bytes){
+    __m128i a, b;
+    // non-temporal stores need an aligned destination
+    bool nt = bytes >= TM_COPY_NT_SIZE;
+    if(nt){
+        while(((uintptr_t)to & 15) && bytes){*to++ = *from++; bytes--;}
+        while(bytes >= 32){
+            a = _mm_loadu_si128((const __m128i *)from);
+            b = _mm_loadu_si128((const __m128i *)(from + 16));
+            _mm_stream_si128((__m128i *)to, a);
+            _mm_stream_si128((__m128i *)(to + 16), b);
+            to += 32; from += 32; bytes -= 32;
+        }
+        _mm_sfence();
+    }
+    while(bytes >= 32){
+        a = _mm_loadu_si128((const __m128i *)from);
+        b = _mm_loadu_si128((const __m128i *)(from + 16));
+        _mm_storeu_si128((__m128i *)to, a);
+        _mm_storeu_si128((__m128i *)(to + 16), b);
+        to += 32; from += 32; bytes -= 32;
+    }
+    mem_move_tail(to, from, bytes);
+}
+
+__attribute__((target("avx2")))
+void            mem_move_down_avx2(uint8_t *to, const uint8_t *from, tm_size_t bytes){
+    __m256i a, b;
+    bool nt = bytes >= TM_COPY_NT_SIZE;
+    if(nt){
+        while(((uintptr_t)to & 31) && bytes){*to++ = *from++; bytes--;}
+        while(bytes >= 64){
+            a = _mm256_loadu_si256((const __m256i *)from);
+            b = _mm256_loadu_si256((const __m256i *)(from + 32));
+            _mm256_stream_si256((__m256i *)to, a);
+            _mm256_stream_si256((__m256i *)(to + 32), b);
+            to += 64; from += 64; bytes -= 64;
+        }
+        _mm_sfence();
+    }
+    while(bytes >= 64){
+        a = _mm256_loadu_si256((const __m256i *)from);
+        b = _mm256_loadu_si256((const __m256i *)(from + 32));
+        _mm256_storeu_si256((__m256i *)to, a);
+        _mm256_storeu_si256((__m256i *)(to + 32), b);
+        to += 64; from += 64; bytes -= 64;
+    }
+    mem_move_tail(to, from, bytes);
+}
+
+void            (*mem_move_down_x86)(uint8_t *, const uint8_t *, tm_size_t) = NULL;
+#endif
+
+void            mem_move_down(void *to, const void *from, const tm_size_t bytes){
+    assert((uint8_t *)to <= (const uint8_t *)from);
+#ifdef TM_COPY_X86
+    void (*move)(uint8_t *, const uint8_t *, tm_size_t);
+    if(bytes < 64){
+        mem_move_tail((uint8_t *)to, (const uint8_t *)from, bytes);
+        return;
+    }
+    // tm_defrag_parallel moves from several threads. They can all resolve
+    //      the kernel, they resolve the same one
+    move = __atomic_load_n(&mem_move_down_x86, __ATOMIC_RELAXED);
+    if(!move){
+        __builtin_cpu_init();
+        move = __builtin_cpu_supports("avx2") ? mem_move_down_avx2 : mem_move_down_sse2;
+        __atomic_store_n(&mem_move_down_x86, move, __ATOMIC_RELAXED);
+    }
+    move((uint8_t *)to, (const uint8_t *)from, bytes);
+#else
+    // data is always block aligned, so copy whole blocks
+    TM_BLOCK_TYPE *t = (TM_BLOCK_TYPE *)to;
+    const TM_BLOCK_TYPE *f = (const TM_BLOCK_TYPE *)from;
+    tm_size_t blocks = bytes / TM_BLOCK_SIZE;
+    assert(!(bytes % TM_BLOCK_SIZE));
+    while(blocks--) *t++ = *f++;
+#endif
+}
+
+
+#ifdef TM_PAGE_RELEASE
+/*---------------------------------------------------------------------------*/
+/*          Returning memory to the OS                                       */
+
+uint32_t        page_release(const uint8_t *start, const uint8_t *end){
+    // release the whole pages between start and end
+    uintptr_t first = ((uintptr_t)start + TM_PAGE_SIZE - 1) & ~(uintptr_t)(TM_PAGE_SIZE - 1);
+    uintptr_t last = (uintptr_t)end & ~(uintptr_t)(TM_PAGE_SIZE - 1);
+    if(last <= first) return 0;
+    TM_PAGE_RELEASE((void *)first, last - first);
+    return last - first;
+}
+
+uint32_t        trim_tail(){
+    // release everything above the heap that was used since the last trim
+    uint32_t released = 0;
+    if(tm_pool.heap_max > HEAP){
+        released = page_release((uint8_t *)LOC_VOID(HEAP), (uint8_t *)LOC_VOID(tm_pool.heap_max));
+    }
+    tm_pool.heap_max = HEAP;
+    return released;
+}
+#endif
+
+
+#ifdef TM_THREAD_POOLS
+/*---------------------------------------------------------------------------*/
+/*          Remote frees                                                     */
+
+void            remote_drain(){
+    // free everything other threads pushed since the last drain
+    tm_index_t index = __atomic_exchange_n(&tm_pool.remote.head, 0, __ATOMIC_ACQUIRE);
+    tm_index_t next;
+    while(index){
+        next = tm_pool.remote.next[index];
+        pool_free(index);
+        index = next;
+    }
+}
+#endif
+
+
+#ifdef TM_REFCOUNT
+/*---------------------------------------------------------------------------*/
+/*          Released data                                                    */
+
+void            release_drain(){
+    // free up to TM_REFCOUNT_BATCH indexes whose last reference was released,
+    //      then join the holes they left in one pass. A run of released
+    //      data becomes a single hole with one index_join
+    tm_index_t batch[TM_REFCOUNT_BATCH];
+    tm_index_t index;
+    uint16_t count = 0, i;
+    uint32_t word, words = PTRS_CAPACITY / INTBITS;
+    unsigned int bits;
+    for(word=0; word<words && count<TM_REFCOUNT_BATCH; word++){
+        if(tm_pool.release_word >= words) tm_pool.release_word = 0;
+        bits = INDEX_BITS(released, tm_pool.release_word * INTBITS);
+        while(bits && count<TM_REFCOUNT_BATCH){
+            index = tm_pool.release_word * INTBITS + __builtin_ctz(bits);
+            bits &= bits - 1;
+            if(index_free(index)) batch[count++] = index;
+        }
+        if(!bits) tm_pool.release_word++;
+    }
+    for(i=0; i<count; i++){
+        index = batch[i];
+        // an index of the batch can already be joined into one before it
+        if(POINTS(index) && !FILLED(index) && !FILLED(NEXT(index))){
+            index_join(index, NEXT(index), NULL);
+        }
+    }
+}
+#endif
+
+#ifdef TM_LARGE_SIZE
+/*---------------------------------------------------------------------------*/
+/*          Large Objects                                                    */
+
+tm_index_t      large_alloc(const tm_size_t size){
+    // Allocate an object outside of the pool. It takes an index (so it is
+    //      referenced like everything else) but it is never part of the
+    //      LOCATION/NEXT chain, so defrag never sees it.
+    tm_index_t index;
+    tm_blocks_t slot;
+    void *ptr;
+    for(slot=0; slot<TM_LARGE_INDEXES; slot++){
+        if(!tm_pool.large_blocks[slot].ptr) break;
+    }
+    if(slot == TM_LARGE_INDEXES) return 0;
+    if(!PTRS_LEFT) return 0;
+    index = find_index();
+    if(!index){
+        DEFRAG_REQUEST();  // need more indexes
+        return 0;
+    }
+    ptr = TM_LARGE_ALLOC(ALIGN_BYTES(size));
+    if(!ptr) return 0;
+    POINTS_SET(index);
+    FILLED_SET(index);
+    LARGE_SET(index);
+    INDEX_TABLE(pointers, index) = (poolptr) {.loc = slot, .next = 0};
+    tm_pool.large_blocks[slot] = (large_block) {.ptr = ptr, .size = ALIGN_BYTES(size)};
+    tm_pool.ptrs_large++;
+    return index;
+}
+
+tm_index_t      large_realloc(const tm_index_t index, const tm_size_t size){
+    // Resize a large object in place, or move data into/out of the pool
+    //      when it crosses TM_LARGE_SIZE
+    tm_index_t new_index;
+    void *ptr;
+#ifdef TM_PIN
+    if(PINNED(index)){
+        // its address has to stay the same and TM_LARGE_REALLOC can move it,
+        //      so a large object can only shrink (it keeps its memory)
+        if(!LARGE(index) || ALIGN_BYTES(size) > LARGE_BLOCK(index).size) return 0;
+        LARGE_BLOCK(index).size = ALIGN_BYTES(size);
+        return index;
+    }
+#endif
+    if(LARGE(index) && size >= TM_LARGE_SIZE){
+        ptr = TM_LARGE_REALLOC(LARGE_BLOCK(index).ptr, ALIGN_BYTES(size));
+        if(!ptr) return 0;
+        LARGE_BLOCK(index) = (large_block) {.ptr = ptr, .size = ALIGN_BYTES(size)};
+        return index;
     }
-    return 0;
+#ifdef TM_REFCOUNT
+    if(REFS(index)) return 0;           // the other references would be lost
+#endif
+    new_index = pool_alloc(size);
+    if(!new_index) return 0;
+    memcpy(tm_void_p(new_index), tm_void_p(index),
+           tm_sizeof(index) < tm_sizeof(new_index) ? tm_sizeof(index) : tm_sizeof(new_index));
+    pool_free(index);
+    return new_index;
+}
+
+void            large_free(const tm_index_t index){
+    assert(LARGE(index));
+    assert(FILLED(index));
+    TM_LARGE_FREE(LARGE_BLOCK(index).ptr);
+    LARGE_BLOCK(index) = (large_block) {.ptr = NULL, .size = 0};
+    INDEX_TABLE(pointers, index) = (poolptr) {.loc = 0, .next = 0};
+    LARGE_CLEAR(index);
+    FILLED_CLEAR(index);
+    POINTS_CLEAR(index);
+    tm_pool.ptrs_large--;
 }
+#endif
 
 
 /*---------------------------------------------------------------------------*/
@@ -658,8 +2419,11 @@ void index_extend(const tm_index_t index, const tm_blocks_t blocks,
     assert(!POINTS(index));
     assert(!FILLED(index));
     POINTS_SET(index);
-    tm_pool.pointers[index] = (poolptr) {.loc = HEAP, .next = 0};
+    INDEX_TABLE(pointers, index) = (poolptr) {.loc = HEAP, .next = 0};
     HEAP += blocks;
+#ifdef TM_PAGE_RELEASE
+    if(HEAP > tm_pool.heap_max) tm_pool.heap_max = HEAP;
+#endif
     if(tm_pool.last_index) NEXT(tm_pool.last_index) = index;
     tm_pool.last_index = index;
     if(!tm_pool.first_index) tm_pool.first_index = index;
@@ -731,6 +2495,10 @@ void index_remove(const tm_index_t index, const tm_index_t prev_index, bool defr
     }
     FILLED_CLEAR(index);
     POINTS_CLEAR(index);
+#ifdef TM_NURSERY
+    if(index == tm_pool.nursery_prev) tm_pool.nursery_prev = prev_index;
+    if(index == tm_pool.nursery_next) tm_pool.nursery_next = prev_index;
+#endif
     // Check for defragmentation settings
     if(!defrag){
         if(index == tm_pool.defrag_index){
@@ -786,7 +2554,7 @@ bool index_split(const tm_index_t index, const tm_blocks_t blocks, tm_index_t ne
     }
 
     tm_pool.ptrs_freed++;
-    tm_pool.pointers[new_index] = (poolptr) {.loc = LOCATION(index) + blocks,
+    INDEX_TABLE(pointers, new_index) = (poolptr) {.loc = LOCATION(index) + blocks,
                                              .next = NEXT(index)};
     NEXT(index) = new_index;
 
@@ -803,6 +2571,244 @@ bool index_split(const tm_index_t index, const tm_blocks_t blocks, tm_index_t ne
 }
 
 
+#ifdef TM_COMPRESS
+/*---------------------------------------------------------------------------*/
+/*          Compression of cold data                                         */
+
+void            compress_step(){
+    // look at a few indexes of the chain and compress the first one that
+    //      wasn't accessed for TM_COMPRESS_CYCLES calls. A cursor that was
+    //      removed in the meantime starts over
+    uint8_t steps;
+    tm_index_t index = tm_pool.compress_index;
+    tm_size_t size;
+    for(steps=0; steps<TM_COMPRESS_STEPS; steps++){
+        if(!index || !POINTS(index)) index = tm_pool.first_index;
+        if(!index) return;
+        tm_pool.compress_index = NEXT(index);
+        if(FILLED(index) && !COMPRESSED(index) && TOUCHED_LOAD(index)
+#ifdef TM_LARGE_SIZE
+                && !LARGE(index)
+#endif
+#ifdef TM_PIN
+                && !PINNED(index)
+#endif
+                && (uint16_t)(tm_pool.epoch - TOUCHED_LOAD(index)) >= TM_COMPRESS_CYCLES){
+            size = tm_sizeof(index);
+            if(size >= TM_COMPRESS_MIN && size <= TM_COMPRESS_MAX
+#ifdef TM_LARGE_SIZE
+                    && size < TM_LARGE_SIZE     // it has to fit in the pool again
+#endif
+                    && index_compress(index)){
+                return;
+            }
+        }
+        index = tm_pool.compress_index;
+    }
+}
+
+bool            index_compress(const tm_index_t index){
+    // compress the data into the start of the index and free the rest. Data
+    //      that doesn't save a block is looked at again after another
+    //      TM_COMPRESS_CYCLES
+    compress_header header = {.size = tm_sizeof(index)};
+    uint16_t touched = TOUCHED_LOAD(index);
+    header.length = lz_compress(tm_void_p(index), header.size, tm_pool.compress_buffer,
+                                header.size - TM_BLOCK_SIZE - sizeof(header));
+    // if tm_access_p touched it in the meantime it isn't cold any more
+    if(!__atomic_compare_exchange_n(&TOUCHED(index), &touched, tm_pool.epoch, false,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) return false;
+    if(!header.length) return false;
+    SEQ_BEGIN();
+    if(!index_split(index, ALIGN_BLOCKS(sizeof(header) + header.length), 0)){
+        SEQ_END();
+        return false;
+    }
+    memcpy(LOC_VOID(LOCATION(index)), &header, sizeof(header));
+    memcpy((uint8_t *)LOC_VOID(LOCATION(index)) + sizeof(header),
+           tm_pool.compress_buffer, header.length);
+    COMPRESSED_SET(index);
+    SEQ_END();
+    return true;
+}
+
+bool            index_decompress(const tm_index_t index){
+    // give the index its whole size back (in place if the space after it is
+    //      free, otherwise in new space that takes over the index) and
+    //      decompress into it. False if the pool has no room for it
+    compress_header header = compressed_header(index);
+    tm_blocks_t blocks = header.size / TM_BLOCK_SIZE;
+    tm_index_t moved;
+    uint16_t bytes;
+#ifdef TM_TAGS
+    tm_tag_stats_t tag_stats = tm_pool.tag_stats[tm_pool.tag];
+#endif
+    assert(COMPRESSED(index));
+    memcpy(tm_pool.compress_buffer, (uint8_t *)LOC_VOID(LOCATION(index)) + sizeof(header),
+           header.length);
+    SEQ_BEGIN();
+    if(!FILLED(NEXT(index))) index_join(index, NEXT(index), NULL);
+    if(BLOCKS(index) >= blocks){
+        // if there is no index for the rest the data just keeps it
+        if(BLOCKS(index) > blocks) index_split(index, blocks, 0);
+    } else if(!NEXT(index) && !STATUS(TM_DEFRAG_IP) && HEAP_LEFT >= blocks - BLOCKS(index)){
+        // the index is at the top of the heap, grow it in place
+        tm_pool.filled_blocks += blocks - BLOCKS(index);
+        HEAP = LOCATION(index) + blocks;
+#ifdef TM_PAGE_RELEASE
+        if(HEAP > tm_pool.heap_max) tm_pool.heap_max = HEAP;
+#endif
+    } else{
+        moved = pool_alloc(header.size);
+        if(!moved){
+            SEQ_END();
+            return false;
+        }
+        index_swap(index, moved);
+        pool_free(moved);       // it has the compressed data now
+#ifdef TM_TAGS
+        tm_pool.tag_stats[tm_pool.tag] = tag_stats;     // not an alloc and free of the program
+#endif
+    }
+    bytes = lz_decompress(tm_pool.compress_buffer, header.length,
+                          LOC_VOID(LOCATION(index)), header.size);
+    assert(bytes == header.size);
+    COMPRESSED_CLEAR(index);
+    SEQ_END();
+    return true;
+}
+
+void            index_swap(const tm_index_t a, const tm_index_t b){
+    // a and b trade their places in the chain, their data stays where it is.
+    //      Only the chain knows what comes before them, so it is walked up
+    //      to the later of the two: O(indexes), under the pool lock
+    poolptr pa = INDEX_TABLE(pointers, a);
+    tm_index_t prev = 0, index = tm_pool.first_index;
+    uint8_t found = 0;
+#define SWAPPED(i)          ((i) == a ? b : (i) == b ? a : (i))
+    assert(FILLED(a) && FILLED(b) && a != b);
+    while(found < 2){
+        assert(index);
+        if(index == a || index == b){
+            found++;
+            if(prev && prev != a && prev != b) NEXT(prev) = SWAPPED(index);
+        }
+        prev = index;
+        index = NEXT(index);
+    }
+    INDEX_TABLE(pointers, a) = (poolptr) {.loc = LOCATION(b), .next = SWAPPED(NEXT(b))};
+    INDEX_TABLE(pointers, b) = (poolptr) {.loc = pa.loc, .next = SWAPPED(pa.next)};
+    tm_pool.first_index = SWAPPED(tm_pool.first_index);
+    tm_pool.last_index = SWAPPED(tm_pool.last_index);
+    tm_pool.defrag_index = SWAPPED(tm_pool.defrag_index);
+    tm_pool.defrag_prev = SWAPPED(tm_pool.defrag_prev);
+    tm_pool.compress_index = SWAPPED(tm_pool.compress_index);
+#ifdef TM_NURSERY
+    tm_pool.nursery_prev = SWAPPED(tm_pool.nursery_prev);
+    tm_pool.nursery_next = SWAPPED(tm_pool.nursery_next);
+#endif
+#ifdef TM_CHECK_STEPS
+    tm_pool.check_index = SWAPPED(tm_pool.check_index);
+#endif
+#undef SWAPPED
+}
+
+static inline compress_header compressed_header(const tm_index_t index){
+    compress_header header;
+    memcpy(&header, LOC_VOID(LOCATION(index)), sizeof(header));
+    return header;
+}
+
+/*
+ * A small LZ77 codec in the format of LZ4 blocks: every sequence is a token
+ * (literal count << 4 | match length - 4), the literals, and the match as a
+ * two byte offset back into the output. Counts of 15 or more continue in
+ * the bytes after them (255 means another byte follows). The last sequence
+ * only has literals.
+ */
+#define LZ_MIN_MATCH        (4)
+#define LZ_HASH_BITS        (10)
+#define LZ_HASH(ptr)        ((lz_read32(ptr) * 2654435761u) >> (32 - LZ_HASH_BITS))
+
+static inline uint32_t lz_read32(const uint8_t *ptr){
+    uint32_t value;
+    memcpy(&value, ptr, 4);
+    return value;
+}
+
+static inline uint8_t *lz_count(uint8_t *out, uint32_t count){
+    // the rest of a count that didn't fit in the token
+    for(; count >= 255; count -= 255) *out++ = 255;
+    *out++ = count;
+    return out;
+}
+
+uint16_t        lz_compress(const uint8_t *in, const uint16_t bytes, uint8_t *out, const uint16_t max){
+    // return the compressed length, 0 if it would be longer than max
+    uint16_t table[1 << LZ_HASH_BITS] = {0};    // last position of every hash
+    const uint8_t *ip = in, *anchor = in, *end = in + bytes, *match;
+    uint8_t *op = out, *token;
+    uint32_t literals, length, hash;
+    while(ip + LZ_MIN_MATCH <= end){
+        hash = LZ_HASH(ip);
+        match = in + table[hash];
+        table[hash] = ip - in;
+        if(match >= ip || lz_read32(match) != lz_read32(ip)){
+            ip++;
+            continue;
+        }
+        for(length=LZ_MIN_MATCH; ip + length < end && match[length] == ip[length]; length++);
+        literals = ip - anchor;
+        // token, literals with their count, offset and match count
+        if((op - out) + literals * 256 / 255 + 2 + 2 + length / 255 + 1 > max) return 0;
+        token = op++;
+        *token = (literals < 15 ? literals : 15) << 4;
+        if(literals >= 15) op = lz_count(op, literals - 15);
+        memcpy(op, anchor, literals);
+        op += literals;
+        *op++ = (ip - match) & 0xFF;
+        *op++ = (ip - match) >> 8;
+        ip += length;
+        anchor = ip;
+        length -= LZ_MIN_MATCH;
+        *token |= length < 15 ? length : 15;
+        if(length >= 15) op = lz_count(op, length - 15);
+    }
+    literals = end - anchor;
+    if((op - out) + literals * 256 / 255 + 2 > max) return 0;
+    *op++ = (literals < 15 ? literals : 15) << 4;
+    if(literals >= 15) op = lz_count(op, literals - 15);
+    memcpy(op, anchor, literals);
+    return op + literals - out;
+}
+
+uint16_t        lz_decompress(const uint8_t *in, const uint16_t length, uint8_t *out, const uint16_t max){
+    // return the decompressed bytes, 0 if the data doesn't fit in max
+    const uint8_t *ip = in, *end = in + length;
+    uint8_t *op = out;
+    uint32_t count, offset;
+    uint8_t token;
+    while(ip < end){
+        token = *ip++;
+        count = token >> 4;
+        if(count == 15) do{ count += *ip; }while(*ip++ == 255);
+        if(count > (uint32_t)(max - (op - out))) return 0;
+        memcpy(op, ip, count);
+        op += count;
+        ip += count;
+        if(ip >= end) break;        // the last sequence has no match
+        offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        count = token & 15;
+        if(count == 15) do{ count += *ip; }while(*ip++ == 255);
+        count += LZ_MIN_MATCH;
+        if(!offset || offset > (uint32_t)(op - out) || count > (uint32_t)(max - (op - out))) return 0;
+        for(; count; count--, op++) *op = *(op - offset);   // can overlap
+    }
+    return op - out;
+}
+#endif
+
 #ifdef TM_TOOLS
 /*###########################################################################*/
 /**
@@ -828,6 +2834,14 @@ void                pool_print(){
     TESTprint("    avail ptrs: filled=  %-7u   freed= %-7u   used=%-7u,    total= %-7u\n",
             tm_pool.ptrs_filled, tm_pool.ptrs_freed, PTRS_USED, TM_POOL_INDEXES);
     TESTprint("    indexes   : first=%u, last=%u\n", tm_pool.first_index, tm_pool.last_index);
+    TESTprint("    defrag    : moved blocks=%u\n", tm_pool.moved_blocks);
+#ifdef TM_PAGE_RELEASE
+    TESTprint("    trim      : heap max=%u\n", tm_pool.heap_max);
+#endif
+#ifdef TM_NURSERY
+    TESTprint("    nursery   : old last=%u, start=%u, old freed=%u\n", tm_pool.nursery_prev,
+            tm_pool.nursery_loc, tm_pool.old_freed_blocks);
+#endif
 }
 
 void                freed_print(){
@@ -931,11 +2945,14 @@ bool            freed_isin(const tm_index_t index){
  */
 bool                pool_isvalid(){
     tm_blocks_t filled = 0, freed=0;
-    tm_index_t ptrs_filled = 1, ptrs_freed = 0;
+    tm_index_t ptrs_filled = 1, ptrs_freed = 0, ptrs_large = 0;
     tm_index_t index;
     bool flast = false, ffirst = false;  // found first/last
     bool freed_first[FREED_BINS] = {0};  // found freed first bin
     bool freed_last[FREED_BINS] = {0};   // found freed last bin
+#ifdef TM_STATS
+    tm_index_t bin_count[FREED_BINS] = {0};
+#endif
     uint8_t bin;
 
     TESTassert(HEAP <= TM_POOL_BLOCKS); TESTassert(BLOCKS_LEFT <= TM_POOL_BLOCKS);
@@ -944,12 +2961,22 @@ bool                pool_isvalid(){
     if(!freed_isvalid()){TESTprint("[ERROR] general freed check failed"); return false;}
 
     // Do a complete check on ALL indexes
-    for(index=1; index<TM_POOL_INDEXES; index++){
+    for(index=1; index<PTRS_CAPACITY; index++){
         if((!POINTS(index)) && FILLED(index)){
             TESTprint("[ERROR] index=%u is filled but doesn't point", index);
             index_print(index);
             return false;
         }
+#ifdef TM_LARGE_SIZE
+        if(LARGE(index)){   // large objects are not part of the pool
+            TESTassert(POINTS(index) && FILLED(index));
+            TESTassert(LOCATION(index) < TM_LARGE_INDEXES);
+            TESTassert(LARGE_BLOCK(index).ptr);
+            TESTassert(tm_pool.last_index != index); TESTassert(tm_pool.first_index != index);
+            ptrs_large++;
+            continue;
+        }
+#endif
         if(POINTS(index)){  // only check indexes that point to something
             TESTassert(NEXT(index) < TM_POOL_INDEXES);
             if(!NEXT(index)){  // This should be the last index
@@ -972,6 +2999,9 @@ bool                pool_isvalid(){
                 }
                 // Make sure the freed arrays have one first and one last
                 bin = freed_bin(BLOCKS(index));
+#ifdef TM_STATS
+                bin_count[bin]++;
+#endif
                 if(!FREE_PREV(index)){  // index should be beginning of freed array
                     if((tm_pool.freed[bin] != index) || freed_first[bin]){
                         DBGprintf("[ERROR] index has no prev but isn't first bin %u:", bin);
@@ -1001,11 +3031,22 @@ bool                pool_isvalid(){
             TESTassert(freed_first[bin] && freed_last[bin]);
         }
         else TESTassert(!(freed_first[bin] || freed_last[bin]));
+        TESTassert(!tm_pool.freed[bin] == !(tm_pool.freed_used & (1 << bin)));
+        TESTassert(tm_pool.freed_max[bin] == freed_max_find(bin, 0));
+#ifdef TM_STATS
+        TESTassert(bin_count[bin] == tm_pool.freed_count[bin]);
+#endif
     }
+    TESTassert(!STATUS(TM_ERROR));
 
     // check that we have proper count of filled and freed
     TESTassert((filled == tm_pool.filled_blocks) && (freed == tm_pool.freed_blocks));
     TESTassert((ptrs_filled == tm_pool.ptrs_filled) && (ptrs_freed == tm_pool.ptrs_freed));
+#ifdef TM_LARGE_SIZE
+    TESTassert(ptrs_large == tm_pool.ptrs_large);
+#else
+    TESTassert(ptrs_large == 0);
+#endif
 
     // Now count filled and freed by going down the index linked list
     filled=0, freed=0, ptrs_freed=0, ptrs_filled=1;
@@ -1020,7 +3061,7 @@ bool                pool_isvalid(){
 
     if(testing){
         // if testing assume that all filled indexes should have correct "filled" data
-        for(index=1; index<TM_POOL_INDEXES; index++){
+        for(index=1; index<PTRS_CAPACITY; index++){
             if(FILLED(index)) TESTassert(check_index(index));
         }
     }
@@ -1035,7 +3076,7 @@ void        fill_index(tm_index_t index){
     tm_blocks_t i;
 
     if(FILLED(index)) data[0] = value;
-    for(i=1; i<BLOCKS(index); i++){
+    for(i=1; i<tm_sizeof(index) / TM_BLOCK_SIZE; i++){
         data[i] = value;
     }
     assert(check_index(index));
@@ -1051,7 +3092,7 @@ bool        check_index(tm_index_t index){
     if(FILLED(index)){
         if(data[0] != value) return false;
     }
-    for(i=1; i<BLOCKS(index); i++){
+    for(i=1; i<tm_sizeof(index) / TM_BLOCK_SIZE; i++){
         if(data[i] != value) return false;
     }
     return true;
@@ -1090,6 +3131,12 @@ void        tfree(tm_index_t index){
     tm_free(index);
     /*fill_index(index);*/
 }
+
+void        tdefrag(){
+    // run a full defrag to completion
+    STATUS_SET(TM_DEFRAG_FULL);
+    while(tm_thread());
+}
 #endif
 
 #ifdef TM_TESTS
@@ -1229,4 +3276,734 @@ char *test_tinymem(
     pool_print();
     return NULL;
 }
+
+/**
+ * Realloc must shrink and grow in place when it can and keep the data when
+ * it has to move it
+ */
+char *test_tm_pool_realloc(){
+    tm_index_t a, b, c, moved;
+    tm_blocks_t loc;
+    tm_reset();
+    testing = true;
+    a = talloc(64, false);
+    b = talloc(64, false);
+    c = talloc(64, false);
+
+    mu_assert(tm_realloc(b, 32) == b);          // shrink
+    mu_assert(tm_sizeof(b) == 32);
+    mu_assert(check_index(b));
+    mu_assert(pool_isvalid());
+
+    loc = LOCATION(c);
+    mu_assert(tm_realloc(c, 256) == c);         // top of the heap, grow in place
+    mu_assert(LOCATION(c) == loc);
+    mu_assert(tm_sizeof(c) == 256);
+    mu_assert(tm_uint32_p(c)[0] == c * PRIME);
+    fill_index(c);
+    mu_assert(pool_isvalid());
+
+    mu_assert(tm_realloc(b, 64) == b);          // joins the freed remainder
+    mu_assert(tm_uint32_p(b)[0] == b * PRIME);
+    fill_index(b);
+    mu_assert(pool_isvalid());
+
+    moved = tm_realloc(a, 128);                 // b is in the way, a must move
+    mu_assert(moved && !FILLED(a));
+    mu_assert(tm_sizeof(moved) == 128);
+    mu_assert(tm_uint32_p(moved)[1] == a * PRIME);
+    fill_index(moved);
+    mu_assert(pool_isvalid());
+
+    mu_assert(tm_realloc(moved, 0) == 0);       // realloc to 0 frees
+    mu_assert(!FILLED(moved));
+    mu_assert(pool_isvalid());
+    testing = false;
+    return NULL;
+}
+
+/**
+ * A defrag that stopped after a hole (the nursery walks over old holes) must
+ * resume right, after the program split that hole or freed the data after it
+ */
+char *test_tm_defrag_resume(){
+    tm_index_t indexes[12], index;
+    uint8_t i, round;
+    for(round=0; round<2; round++){
+        tm_reset();
+        testing = true;
+        for(i=0; i<12; i++){
+            indexes[i] = tm_alloc(i == 2 ? 192 : 64);
+            fill_index(indexes[i]);
+        }
+        tm_free(indexes[2]);
+        tm_free(indexes[7]);
+        // a slice stopped with defrag_prev on the hole
+        STATUS_SET(TM_DEFRAG_FULL_IP);
+        tm_pool.defrag_prev = indexes[2];
+        tm_pool.defrag_index = indexes[3];
+        if(!round){
+            // split off of defrag_prev: a new hole comes before defrag_index
+            index = tm_alloc(128);
+            mu_assert(index == indexes[2]);
+            fill_index(index);
+        }
+        tm_free(indexes[3]);        // defrag_index is a hole too
+        while(tm_thread());
+        mu_assert(!STATUS(TM_ANY_DEFRAG) && pool_isvalid());
+        for(i=0; i<12; i++) mu_assert(i == 3 || i == 7 || (round && i == 2) || check_index(indexes[i]));
+    }
+    testing = false;
+    return NULL;
+}
+
+/**
+ * tm_alloc_wait must defrag inside of the call when the pool is fragmented,
+ * and give up when it has no time
+ */
+char *test_tm_alloc_wait(){
+    tm_index_t indexes[TM_POOL_INDEXES];
+    tm_index_t index;
+    uint32_t i, n, spent;
+    void *before;
+    tm_reset();
+    testing = true;
+    for(n=0; n<TM_POOL_INDEXES; n++){
+        indexes[n] = tm_alloc(64);
+        if(!indexes[n]) break;
+        fill_index(indexes[n]);
+    }
+    for(i=0; i<n; i+=2) tm_free(indexes[i]);
+    STATUS_CLEAR(TM_ANY_DEFRAG);
+    mu_assert(BLOCKS_LEFT > ALIGN_BLOCKS(1024) && HEAP_LEFT < ALIGN_BLOCKS(1024));
+
+    mu_assert(!tm_alloc_wait(1024, 0, &spent));         // no time to defrag
+    index = tm_alloc_wait(1024, 1000000000, &spent);
+    mu_assert(index && tm_sizeof(index) == 1024);
+    mu_assert(spent > 0 && spent < 1000000000);
+    fill_index(index);
+    mu_assert(pool_isvalid());
+    tdefrag();
+    mu_assert(pool_isvalid());
+
+    // only the window with the least data to move is compacted: in the
+    //      second half 3 of every 4 blocks are free
+    tm_reset();
+    for(n=0; n<TM_POOL_INDEXES; n++){
+        indexes[n] = tm_alloc(64);
+        if(!indexes[n]) break;
+        fill_index(indexes[n]);
+    }
+    for(i=0; i<n; i++){
+        if(!(i % 2) || (i > n / 2 && i % 4 == 1)) tm_free(indexes[i]);
+    }
+    STATUS_CLEAR(TM_ANY_DEFRAG);
+    before = tm_void_p(indexes[1]);
+    mu_assert(HEAP_LEFT < ALIGN_BLOCKS(1024));
+    index = tm_alloc_wait(1024, 1000000000, &spent);
+    mu_assert(index);
+    fill_index(index);
+    mu_assert(tm_void_p(indexes[1]) == before);    // the first half didn't move
+    mu_assert(!STATUS(TM_ANY_DEFRAG) && pool_isvalid());
+    for(i=1; i<n; i+=2) mu_assert((i > n / 2 && i % 4 == 1) || check_index(indexes[i]));
+
+#ifdef TM_LARGE_SIZE
+    // no defrag makes room for a large object
+    tm_reset();
+    indexes[0] = tm_alloc(64);
+    index = tm_alloc(64);
+    tm_free(indexes[0]);                        // a hole defrag would close
+    before = tm_void_p(index);
+    while(tm_alloc(TM_LARGE_SIZE));             // all the large slots are taken
+    mu_assert(!tm_alloc_wait(TM_LARGE_SIZE, 1000000000, &spent));
+    mu_assert(tm_void_p(index) == before && !STATUS(TM_DEFRAG_IP));
+    tm_reset();
+#endif
+    testing = false;
+    return NULL;
+}
+
+/**
+ * The largest free extent and the fragmentation must follow frees and
+ * allocations, and tm_can_alloc must agree with tm_alloc
+ */
+char *test_tm_largest_free(){
+    tm_index_t big, mid, odd, index;
+    tm_reset();
+    mu_assert(tm_largest_free() == TM_POOL_BLOCKS * TM_BLOCK_SIZE);
+    mu_assert(tm_fragmentation() == 0);
+    tm_alloc(64);
+    big = tm_alloc(8192);
+    tm_alloc(64);
+    mid = tm_alloc(2048);
+    tm_alloc(64);
+    odd = tm_alloc(3000);
+    tm_alloc(64);
+    mu_assert(tm_alloc(HEAP_LEFT_BYTES));       // nothing left on the heap
+    mu_assert(tm_largest_free() == 0 && !tm_can_alloc(4));
+
+    tm_free(big);
+    tm_free(mid);
+    mu_assert(pool_isvalid());
+    mu_assert(tm_largest_free() == 8192);
+    mu_assert(tm_fragmentation() == 20);
+    mu_assert(tm_can_alloc(8192) && !tm_can_alloc(8196));
+    mu_assert(!tm_alloc(8196));
+
+    index = tm_alloc(8192);                     // takes the whole hole of big
+    mu_assert(index && pool_isvalid());
+    mu_assert(tm_largest_free() == 2048);
+    mu_assert(tm_can_alloc(2048) && !tm_can_alloc(2052));
+    mu_assert(!tm_alloc(2052));
+    mu_assert(tm_alloc(2048));
+    mu_assert(tm_largest_free() == 0 && tm_fragmentation() == 0);
+
+    // a size in the middle of a bin is exact, but only the sizes that are
+    //      sure to fit any index of the bin are taken without a defrag
+    tm_free(odd);
+    mu_assert(tm_largest_free() == 3000 && tm_fragmentation() == 0);
+    mu_assert(tm_can_alloc(2048) && !tm_can_alloc(3000));
+    mu_assert(pool_isvalid());
+    return NULL;
+}
+
+#ifdef TM_CHECK_STEPS
+/**
+ * The incremental check must pass on a busy pool and find corruption of
+ * the bit arrays and of the index chain within a bounded number of calls
+ */
+char *test_tm_check(){
+    tm_index_t indexes[64], a, b;
+    uint32_t i, calls;
+    tm_reset();
+    for(i=0; i<64; i++) indexes[i] = tm_alloc(4 + (i % 5) * 12);
+    for(i=0; i<64; i+=3) tm_free(indexes[i]);
+    for(i=0; i<MAX_BIT_INDEXES + 64; i++){
+        if(!(i % 16)) STATUS_SET(TM_DEFRAG_FULL);
+        tm_thread();
+        mu_assert(!STATUS(TM_ERROR));
+    }
+
+    // an index that doesn't point but is filled
+    FILLED_SET(PTRS_CAPACITY - 1);
+    for(calls=0; calls<PTRS_CAPACITY / INTBITS && !STATUS(TM_ERROR); calls++) tm_thread();
+    mu_assert(STATUS(TM_ERROR));
+    FILLED_CLEAR(PTRS_CAPACITY - 1);
+    STATUS_CLEAR(TM_ERROR);
+
+#ifdef TM_LARGE_SIZE
+    // the chain cursor was freed and its index reused for a large object
+    a = tm_alloc(TM_LARGE_SIZE);
+    mu_assert(a && LARGE(a));
+    tm_pool.check_index = a;
+    for(calls=0; calls<64; calls++) tm_thread();
+    mu_assert(!STATUS(TM_ERROR));
+    tm_free(a);
+#endif
+
+    // two indexes in the chain with swapped locations
+    a = tm_pool.first_index;
+    b = NEXT(a);
+    LOCATION(a) = LOCATION(NEXT(b)) - 1;
+    for(calls=0; calls<64 && !STATUS(TM_ERROR); calls++) tm_thread();
+    mu_assert(STATUS(TM_ERROR));
+    tm_reset();
+    return NULL;
+}
+#endif
+
+#ifdef TM_PIN
+/**
+ * Defrag must compact the data around a pinned index without moving it
+ */
+char *test_tm_pin(){
+    tm_index_t a, b, pinned, c, d;
+    uint8_t *ptr, *bottom;
+    tm_reset();
+    a = tm_alloc(64);
+    b = tm_alloc(64);
+    pinned = tm_alloc(128);
+    c = tm_alloc(64);
+    d = tm_alloc(64);
+    fill_index(b); fill_index(pinned); fill_index(d);
+    bottom = tm_void_p(a);
+    tm_free(a);
+    tm_free(c);
+    ptr = tm_pin(pinned);
+    mu_assert(ptr == tm_void_p(pinned));
+
+    tdefrag();
+    mu_assert(pool_isvalid());
+    mu_assert(tm_void_p(pinned) == ptr);
+    mu_assert(tm_void_p(b) == bottom);            // moved to the bottom
+    mu_assert(tm_void_p(d) == ptr + 128);               // moved next to it
+    mu_assert(tm_pool.freed_blocks == ALIGN_BLOCKS(64));   // the hole below it
+    mu_assert(check_index(b) && check_index(pinned) && check_index(d));
+    mu_assert(!tm_realloc(pinned, 256));                // can't grow in place
+    mu_assert(tm_realloc(pinned, 64) == pinned && tm_void_p(pinned) == ptr);
+
+    tm_unpin(pinned);
+    tdefrag();
+    mu_assert(pool_isvalid());
+    mu_assert(tm_void_p(pinned) == (uint8_t *)tm_void_p(b) + 64);
+    mu_assert(tm_pool.freed_blocks == 0);
+
+    tm_pin(pinned);
+    tm_free(pinned);                                    // unpins
+    mu_assert(!PINNED(pinned));
+
+#ifdef TM_LARGE_SIZE
+    // neither moving into a large object nor TM_LARGE_REALLOC may move it
+    a = tm_alloc(64);
+    ptr = tm_pin(a);
+    mu_assert(!tm_realloc(a, TM_LARGE_SIZE) && tm_void_p(a) == ptr);
+    tm_unpin(a);
+    b = tm_alloc(TM_LARGE_SIZE);
+    ptr = tm_pin(b);
+    mu_assert(LARGE(b) && PINNED(b));
+    mu_assert(!tm_realloc(b, TM_LARGE_SIZE * 4) && tm_void_p(b) == ptr);
+    mu_assert(tm_realloc(b, 64) == b && tm_void_p(b) == ptr && tm_sizeof(b) == 64);
+    tm_free(b);
+    mu_assert(!PINNED(b) && pool_isvalid());
+#endif
+    tm_reset();
+    return NULL;
+}
+#endif
+
+#ifdef TM_DEFRAG_THREADS
+/**
+ * A parallel compaction must leave the same pool as a serial full defrag:
+ * all data packed at the bottom, in order and unchanged
+ */
+char *test_tm_defrag_parallel(){
+    tm_index_t index, prev;
+    uint32_t round, freed;
+    defrag_work work;
+    for(round=0; round<12; round++){
+        // rounds 8 and up free little, so heads are parked, except for
+        //      round 11 which fills the pool and has no room for them
+        tm_reset();
+        while(tm_pool.filled_blocks < TM_POOL_BLOCKS / (round == 11 ? 1 : 2)){
+            index = tm_alloc(4 + rand() % (round % 2 ? 2000 : 120));
+            if(!index) break;
+            fill_index(index);
+        }
+        for(index=1; index<PTRS_CAPACITY; index++){
+            if(FILLED(index) && (round < 8 ? rand() % 3 : !(rand() % 32))) tm_free(index);
+        }
+        mu_assert(parallel_regions(&work));
+        mu_assert(work.parked <= HEAP_LEFT);
+        if(round >= 8 && round < 11) mu_assert(work.parked);
+        freed = tm_pool.freed_blocks * TM_BLOCK_SIZE;
+        if(round == 7) DEFRAG_REQUEST();            // a defrag was requested
+        mu_assert(tm_defrag_parallel(round % 4 + 1) == freed);
+        mu_assert(pool_isvalid());
+        mu_assert(!tm_pool.freed_blocks && HEAP == tm_pool.filled_blocks);
+        mu_assert(!STATUS(TM_ANY_DEFRAG) && STATUS(TM_DEFRAG_FULL_DONE));
+        for(index=tm_pool.first_index, prev=0; index; prev=index, index=NEXT(index)){
+            mu_assert(FILLED(index) && check_index(index));
+            mu_assert(!prev || LOCATION(index) == LOCATION(prev) + BLOCKS(prev));
+        }
+        mu_assert(round == 11 || !tm_thread());     // a full heap keeps it busy
+    }
+    tm_reset();
+    return NULL;
+}
+#endif
+
+#ifdef TM_TAGS
+/**
+ * The counters of a tag must follow its data through realloc, free and
+ * defrag, and untagged data must be counted as tag 0
+ */
+char *test_tm_tags(){
+    tm_index_t a, b, c, other;
+    tm_tag_stats_t stats;
+    tm_reset();
+    other = tm_alloc(32);
+    a = tm_alloc_tagged(64, 1);
+    b = tm_alloc_tagged(16, 1);
+    c = tm_alloc(48);
+    mu_assert(tm_tag(a) == 1 && tm_tag(c) == 0 && tm_tag(other) == 0);
+    stats = tm_tag_stats(1);
+    mu_assert(stats.live_bytes == 80 && stats.count == 2 && stats.allocs == 2);
+    mu_assert(tm_tag_stats(0).live_bytes == 80 && tm_tag_stats(0).count == 2);
+
+    b = tm_realloc(b, 128);                     // moves to the top of the heap
+    mu_assert(b && tm_tag(b) == 1);
+    stats = tm_tag_stats(1);
+    mu_assert(stats.live_bytes == 192 && stats.count == 2);
+    mu_assert(stats.allocs == 3 && stats.frees == 1);
+    mu_assert(tm_realloc(b, 256) == b);         // grows in place
+    mu_assert(tm_realloc(a, 32) == a);          // shrinks
+    mu_assert(tm_tag_stats(1).live_bytes == 288);
+
+    tm_free(other);
+    tdefrag();
+    stats = tm_tag_stats(1);
+    mu_assert(stats.moved_bytes == 32 + 256 && tm_tag_stats(0).moved_bytes == 48);
+    tm_free(a);
+    tm_free(b);
+    stats = tm_tag_stats(1);
+    mu_assert(stats.live_bytes == 0 && stats.count == 0 && stats.frees == 3);
+    mu_assert(tm_tag_stats(0).live_bytes == 48 && tm_tag_stats(0).frees == 1);
+    mu_assert(pool_isvalid());
+    tm_reset();
+    mu_assert(tm_tag_stats(1).allocs == 0);
+    return NULL;
+}
+#endif
+
+#ifdef TM_COMPRESS
+/**
+ * Data that isn't accessed any more must be compressed by tm_thread and come
+ * back unchanged, whether it can grow in place or has to move
+ */
+void        compress_fill(uint8_t *data, tm_size_t bytes, uint8_t seed){
+    tm_size_t i;
+    for(i=0; i<bytes; i++) data[i] = i % 64 ? (uint8_t)"cold data "[i % 10] : (uint8_t)(seed + i / 64);
+}
+
+bool        compress_check(const uint8_t *data, tm_size_t bytes, uint8_t seed){
+    tm_size_t i;
+    if(!data) return false;
+    for(i=0; i<bytes; i++){
+        if(data[i] != (i % 64 ? (uint8_t)"cold data "[i % 10] : (uint8_t)(seed + i / 64))) return false;
+    }
+    return true;
+}
+
+char *test_tm_compress(){
+    tm_index_t a, b, c, noise, freed;
+    tm_blocks_t used, location;
+    uint8_t *ptr;
+    uint32_t i;
+    tm_reset();
+    a = tm_alloc(1024);
+    b = tm_alloc(512);                  // only read with tm_void_p
+    noise = tm_alloc(256);
+    freed = tm_alloc(256);
+    compress_fill(tm_access_p(a), 1024, 1);
+    compress_fill(tm_void_p(b), 512, 2);
+    ptr = tm_access_p(noise);
+    for(i=0; i<256; i++) ptr[i] = rand();
+    compress_fill(tm_access_p(freed), 256, 3);
+    used = tm_pool.filled_blocks;
+    for(i=0; i<TM_COMPRESS_CYCLES + 8; i++) tm_thread();
+    mu_assert(tm_compressed(a) && tm_compressed(freed));
+    mu_assert(!tm_compressed(b) && !tm_compressed(noise));
+    mu_assert(!tm_void_p(a) && tm_sizeof(a) == 1024);
+    mu_assert(tm_pool.filled_blocks < used - ALIGN_BLOCKS(1024 + 256) / 2);
+    mu_assert(pool_isvalid());
+    tm_free(freed);
+    mu_assert(!tm_compressed(freed) && pool_isvalid());
+
+    // the space after it is still free: decompressed in place
+    used = tm_pool.filled_blocks;
+    location = LOCATION(a);
+    ptr = tm_access_p(a);
+    mu_assert(ptr && LOCATION(a) == location && !tm_compressed(a));
+    mu_assert(compress_check(ptr, 1024, 1) && tm_sizeof(a) == 1024);
+    mu_assert(tm_pool.filled_blocks > used && pool_isvalid());
+
+    // the space after it was taken: it moves to new space
+    for(i=0; i<TM_COMPRESS_CYCLES + 8; i++) tm_thread();
+    mu_assert(tm_compressed(a));
+    c = tm_alloc(512);
+    mu_assert(c && LOCATION(c) > LOCATION(a) && LOCATION(c) < LOCATION(b));
+    ptr = tm_access_p(a);
+    mu_assert(ptr && LOCATION(a) > LOCATION(noise) && !tm_compressed(a));
+    mu_assert(compress_check(ptr, 1024, 1) && compress_check(tm_void_p(b), 512, 2));
+    mu_assert(pool_isvalid());
+
+    // realloc decompresses
+    for(i=0; i<TM_COMPRESS_CYCLES + 8; i++) tm_thread();
+    mu_assert(tm_compressed(a));
+    a = tm_realloc(a, 2048);
+    mu_assert(a && !tm_compressed(a) && compress_check(tm_void_p(a), 1024, 1));
+    tdefrag();
+    mu_assert(pool_isvalid());
+    tm_reset();
+    return NULL;
+}
+#endif
+
+#ifdef TM_REFCOUNT
+/**
+ * Data whose last reference is released stays until tm_thread, and released
+ * data next to each other becomes a single hole
+ */
+char *test_tm_refcount(){
+    tm_index_t a, b, indexes[50];
+    uint32_t i;
+    tm_reset();
+    a = tm_alloc(64);
+    mu_assert(tm_refs(a) == 1);
+    mu_assert(tm_retain(a) == a && tm_retain(a) == a && tm_refs(a) == 3);
+    mu_assert(!tm_release(a) && !tm_release(a) && tm_refs(a) == 1);
+    mu_assert(tm_release(a) && !tm_refs(a));
+    mu_assert(tm_valid(a) && tm_pool.ptrs_released == 1 && pool_isvalid());
+    mu_assert(!tm_thread());
+    mu_assert(!tm_valid(a) && !tm_pool.ptrs_released && pool_isvalid());
+
+    tm_reset();
+    for(i=0; i<50; i++) indexes[i] = tm_alloc(16 + i % 4 * 16);
+    b = tm_alloc(16);
+    for(i=0; i<50; i++) mu_assert(tm_release(indexes[i]));
+    mu_assert(tm_pool.ptrs_released == 50 && !tm_pool.ptrs_freed);
+    mu_assert(!tm_thread());
+    mu_assert(!tm_pool.ptrs_released && tm_pool.ptrs_freed == 1);
+    mu_assert(tm_valid(b) && pool_isvalid());
+
+    // shared data can't move, but tm_free always frees it
+    a = tm_alloc(64);
+    b = tm_alloc(64);
+    mu_assert(tm_retain(a) == a);
+    mu_assert(!tm_realloc(a, 256) && tm_sizeof(a) == 64);
+    mu_assert(tm_realloc(a, 32) == a && tm_refs(a) == 2);
+    mu_assert(!tm_release(a) && tm_release(a));
+    tm_free(a);
+    mu_assert(!tm_valid(a) && !REFS(a) && !RELEASED(a));
+    mu_assert(!tm_pool.ptrs_released && pool_isvalid());
+    tm_reset();
+    return NULL;
+}
+#endif
+
+#ifdef TM_INDEX_CHUNK
+/**
+ * Running out of indexes must add a chunk instead of requesting a defrag,
+ * and indexes from the first chunks must stay valid
+ */
+char *test_tm_index_grow(){
+    tm_index_t first, index, kept = 0;
+    uint32_t i;
+    tm_reset();
+    testing = true;
+    mu_assert(PTRS_CAPACITY == TM_INDEX_CHUNK);
+    first = talloc(8, false);
+    for(i=0; i<TM_INDEX_CHUNK * 3; i++){
+        index = talloc(4, false);
+        mu_assert(index);
+        if(i % 3) tfree(index);
+        else kept = index;
+    }
+    mu_assert(PTRS_CAPACITY > TM_INDEX_CHUNK);
+    mu_assert(!STATUS(TM_ANY_DEFRAG));
+    mu_assert(kept >= TM_INDEX_CHUNK && tm_valid(kept));
+    mu_assert(check_index(first) && pool_isvalid());
+    tdefrag();
+    mu_assert(check_index(first) && check_index(kept) && pool_isvalid());
+    tm_reset();
+    mu_assert(PTRS_CAPACITY == TM_INDEX_CHUNK && !tm_valid(kept));
+    testing = false;
+    return NULL;
+}
+#endif
+
+#ifdef TM_THREADSAFE
+#include <pthread.h>
+#define THREAD_READERS      (3)
+#define THREAD_INDEXES      (512)
+#define THREAD_WORDS        ((4 + 6 * 32) / sizeof(uint32_t))    // largest index
+
+tm_index_t  thread_indexes[THREAD_INDEXES];
+bool        thread_stop;
+uint32_t    thread_reads;
+
+void        *thread_reader(void *bad){
+    // read the filled data while the main thread defrags. Inside of a read
+    //      section the data may be stale, but never once it is complete
+    uint32_t seq, i, j, words, first, *data;
+    tm_index_t index;
+    for(i=0; !__atomic_load_n(&thread_stop, __ATOMIC_RELAXED); i++){
+        index = thread_indexes[i % THREAD_INDEXES];
+        do{
+            // the size and location can be half updated in here, so they
+            //      are bounded before anything is read through them
+            seq = tm_read_begin();
+            words = tm_sizeof(index) / sizeof(uint32_t);
+            if(words > THREAD_WORDS) words = THREAD_WORDS;
+            data = tm_uint32_p(index);
+            first = data ? data[0] : 0;
+            for(j=1; data && j<words; j++) if(data[j] != first) break;
+        }while(tm_read_retry(seq));
+        if(j != words || first != index * PRIME) __atomic_add_fetch((uint32_t *)bad, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&thread_reads, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+/**
+ * Readers that don't take the lock must always see complete data while
+ * tm_thread moves it
+ */
+char *test_tm_threadsafe(){
+    pthread_t readers[THREAD_READERS];
+    tm_index_t holes[THREAD_INDEXES];
+    uint32_t bad = 0, seq;
+    uint16_t round, i;
+    testing = true;
+    for(round=0; round<20; round++){
+        tm_reset();
+        for(i=0; i<THREAD_INDEXES; i++){
+            holes[i] = talloc(4 + ((i + round) % 16) * 16, false);
+            thread_indexes[i] = talloc(4 + (i % 7) * 32, false);
+        }
+        for(i=0; i<THREAD_INDEXES; i++) tfree(holes[i]);
+        thread_stop = false;
+        thread_reads = 0;
+        for(i=0; i<THREAD_READERS; i++) pthread_create(&readers[i], NULL, thread_reader, &bad);
+        while(__atomic_load_n(&thread_reads, __ATOMIC_RELAXED) < 1000);
+        seq = tm_seq;
+        tdefrag();
+        mu_assert(tm_seq != seq);       // data was moved
+        __atomic_store_n(&thread_stop, true, __ATOMIC_RELAXED);
+        for(i=0; i<THREAD_READERS; i++) pthread_join(readers[i], NULL);
+        mu_assert(bad == 0);
+        mu_assert(pool_isvalid());
+    }
+    mu_assert(!(tm_seq & 1));
+    testing = false;
+    return NULL;
+}
+#endif
+
+#ifdef TM_THREAD_POOLS
+#include <pthread.h>
+#define REMOTE_INDEXES      (1000)
+
+tm_owner_t  remote_owner;
+tm_index_t  remote_indexes[REMOTE_INDEXES];
+uint8_t     remote_state;       // 1: indexes are ready, 2: they were all freed
+
+void        *remote_owner_thread(void *left){
+    // allocate in this thread's pool, then keep working until the other
+    //      threads' frees have been drained
+    uint16_t i;
+    for(i=0; i<REMOTE_INDEXES; i++) remote_indexes[i] = tm_alloc(8 + i % 64);
+    remote_owner = tm_owner();
+    __atomic_store_n(&remote_state, 1, __ATOMIC_RELEASE);
+    while(__atomic_load_n(&remote_state, __ATOMIC_ACQUIRE) != 2) tm_thread();
+    tm_thread();
+    *(tm_index_t *)left = tm_pool.ptrs_filled - 1;
+    return NULL;
+}
+
+void        *remote_free_thread(void *start){
+    uint16_t i;
+    for(i=*(uint16_t *)start; i<REMOTE_INDEXES; i+=2){
+        tm_free_remote(remote_owner, remote_indexes[i]);
+    }
+    return NULL;
+}
+
+/**
+ * Indexes freed by two other threads must all be freed by their owner,
+ * and must not touch the pools of the freeing threads
+ */
+char *test_tm_thread_pools(){
+    pthread_t owner, other;
+    tm_index_t left = 1, mine;
+    uint16_t even = 0, odd = 1;
+    tm_reset();
+    mine = tm_alloc(64);
+    mu_assert(mine);
+    remote_state = 0;
+    pthread_create(&owner, NULL, remote_owner_thread, &left);
+    while(__atomic_load_n(&remote_state, __ATOMIC_ACQUIRE) != 1);
+    mu_assert(remote_owner != tm_owner());
+
+    pthread_create(&other, NULL, remote_free_thread, &odd);
+    remote_free_thread(&even);
+    pthread_join(other, NULL);
+    __atomic_store_n(&remote_state, 2, __ATOMIC_RELEASE);
+    pthread_join(owner, NULL);
+
+    mu_assert(left == 0);
+    mu_assert(tm_pool.ptrs_filled == 2 && FILLED(mine));
+    tm_free_remote(tm_owner(), mine);   // the own pool frees right away
+    mu_assert(!FILLED(mine));
+    mu_assert(pool_isvalid());
+    return NULL;
+}
+#endif
+
+#ifdef TM_PAGE_RELEASE
+/**
+ * Trimming must release the pages above the heap and inside of large holes
+ * without touching live data or the freed lists
+ */
+char *test_tm_trim(){
+    tm_index_t indexes[8];
+    uint8_t i;
+    tm_reset();
+    testing = true;
+    for(i=0; i<8; i++) indexes[i] = talloc(TM_PAGE_SIZE * 3, false);
+    mu_assert(tm_trim() == 0);
+    tfree(indexes[2]);
+    mu_assert(tm_trim() >= TM_PAGE_SIZE);       // the inside of the hole
+    mu_assert(tm_trim() == 0);                  // it was already released
+    mu_assert(pool_isvalid());
+    indexes[2] = talloc(TM_PAGE_SIZE * 3, false);
+    mu_assert(tm_trim() == 0);
+    tfree(indexes[2]);                          // used again, released again
+    mu_assert(tm_trim() >= TM_PAGE_SIZE);
+    mu_assert(tm_trim() == 0);
+
+    for(i=3; i<8; i++) tfree(indexes[i]);
+    STATUS_SET(TM_DEFRAG_FULL);
+    while(tm_thread());
+    mu_assert(pool_isvalid());
+    tm_trim();      // tm_thread may already have trimmed the heap
+    mu_assert(tm_pool.heap_max == HEAP);
+    mu_assert(tm_trim() == 0);
+    for(i=0; i<2; i++) mu_assert(check_index(indexes[i]));
+    indexes[2] = talloc(TM_PAGE_SIZE * 3, false);
+    mu_assert(pool_isvalid());
+    testing = false;
+    return NULL;
+}
+#endif
+
+#ifdef TM_LARGE_SIZE
+/**
+ * Large objects must keep their address through a full defrag and must not
+ * count towards the pool's blocks
+ */
+char *test_tm_large(){
+    tm_index_t small[4], large;
+    void *large_p;
+    uint8_t i;
+    tm_reset();
+    testing = true;
+    for(i=0; i<4; i++) small[i] = talloc(64, false);
+    large = talloc(TM_LARGE_SIZE, false);
+    mu_assert(LARGE(large));
+    mu_assert(tm_sizeof(large) == ALIGN_BYTES(TM_LARGE_SIZE));
+    mu_assert(tm_pool.filled_blocks == 4 * ALIGN_BLOCKS(64));
+    mu_assert(pool_isvalid());
+
+    large_p = tm_void_p(large);
+    tfree(small[0]); tfree(small[2]);
+    STATUS_SET(TM_DEFRAG_FULL);
+    while(tm_thread());
+    mu_assert(tm_pool.freed_blocks == 0);
+    mu_assert(tm_void_p(large) == large_p);
+    mu_assert(pool_isvalid());
+
+    large = tm_realloc(large, TM_LARGE_SIZE * 2);
+    mu_assert(LARGE(large));
+    mu_assert(tm_uint32_p(large)[0] == large * PRIME);
+    fill_index(large);
+    mu_assert(pool_isvalid());
+
+    tfree(large);
+    mu_assert(tm_pool.ptrs_large == 0);
+    mu_assert(pool_isvalid());
+    testing = false;
+    return NULL;
+}
+#endif
 #endif
@@ -15,6 +15,15 @@
 #include <assert.h>     // assert
 #endif
 
+#ifdef __cplusplus
+// the inline functions are defined in tinymem.c, C++ links to them as
+// ordinary extern "C" functions
+#define TM_INLINE
+extern "C" {
+#else
+#define TM_INLINE       inline
+#endif
+
 
 
 
@@ -55,14 +64,27 @@ typedef uint32_t        tm_size_t;
  * \brief               Completely resets the internal pool.
  *                      ALL DATA WILL BE LOST
  */
-inline void         tm_reset();
+TM_INLINE void      tm_reset();
+
+#ifdef TM_HUGEPAGE_SIZE
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           Back the pool with huge pages and reset it.
+ *                  Call once at startup, before anything is allocated.
+ *                  ALL DATA WILL BE LOST
+ *
+ * \return bool     true if the pages could be remapped. If false the pool
+ *                  still works with the pages it already had
+ */
+bool                tm_hugepage();
+#endif
 
 /*---------------------------------------------------------------------------*/
 /**
  * \brief           Get the sizeof data at index in bytes
  * \return tm_size_t  the sizeof the data pointed to by index
  */
-inline tm_size_t    tm_sizeof(const tm_index_t index);
+TM_INLINE tm_size_t tm_sizeof(const tm_index_t index);
 
 /*---------------------------------------------------------------------------*/
 /**
@@ -87,7 +109,7 @@ inline tm_size_t    tm_sizeof(const tm_index_t index);
  * \param index     tm_index_t to get pointer to
  * \return          void* pointer to actual data
  */
-inline void*        tm_void_p(const tm_index_t index);
+TM_INLINE void*     tm_void_p(const tm_index_t index);
 
 /*---------------------------------------------------------------------------*/
 /**
@@ -99,6 +121,28 @@ inline void*        tm_void_p(const tm_index_t index);
  */
 tm_index_t          tm_alloc(tm_size_t size);
 
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           allocate memory, defragmenting inside of the call if needed
+ *
+ *                  When tm_alloc fails because the pool is fragmented, this
+ *                  runs defrag slices and retries after every slice, until
+ *                  the allocation succeeds or budget_ns has passed.
+ *
+ *                  The defrag is targeted at the size: it starts at the
+ *                  freed data where the least data has to move to make a
+ *                  hole of size (found with one walk of the index chain,
+ *                  cut short by the budget) and stops once the allocation
+ *                  fits. Only if that isn't enough (pinned data, no free
+ *                  indexes) does a full defrag run. Large objects don't wait.
+ *
+ * \param size      size of pointer to allocate
+ * \param budget_ns maximum time to spend defragmenting (checked per slice)
+ * \param spent_ns  if not NULL, set to the time spent in the call
+ * \return          tm_index_t or 0 if there is not enough memory or time
+ */
+tm_index_t          tm_alloc_wait(tm_size_t size, const uint32_t budget_ns, uint32_t *spent_ns);
+
 /*---------------------------------------------------------------------------*/
 /**
  * \brief           changes the size of memory in the pool
@@ -145,7 +189,296 @@ bool            tm_valid(const tm_index_t index);
  * \param index     tm_index_t to possibly valid data
  * \return bool     true if valid and size matches, false otherwise
  */
-inline bool     tm_check(const tm_index_t index, const tm_size_t size);
+TM_INLINE bool     tm_check(const tm_index_t index, const tm_size_t size);
+
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           run the memory manager for a short stint of time
+ *                  Defragments the pool when a defrag has been requested.
+ *                  Data can move, so pointers from tm_void_p must be looked
+ *                  up again after calling it.
+ *
+ * \return bool     true if there is more work to do
+ */
+TM_INLINE bool      tm_thread();
+
+#ifdef TM_DEFRAG_THREADS
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           compact the whole pool now, with up to threads threads
+ *                  (TM_DEFRAG_THREADS)
+ *
+ *                  Unlike tm_thread this doesn't stop after a short time:
+ *                  the pool is locked until all data is packed at the bottom
+ *                  (use it when the program can pause, e.g. between frames
+ *                  or requests). The calling thread is one of the threads.
+ *                  Use at most one thread per core, waiting threads spin.
+ *                  The free space above the heap is used as scratch, so it
+ *                  scales best when the heap isn't full. Threads are
+ *                  started by every call, for small pools define
+ *                  TM_THREAD_START to hand the work to running threads.
+ *                  With pinned data it falls back to a serial full defrag.
+ *
+ * \return          bytes recovered
+ */
+uint32_t            tm_defrag_parallel(uint8_t threads);
+#endif
+
+#ifdef TM_PIN
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           Pin data so that it doesn't move (TM_PIN)
+ *
+ *                  Defrag skips pinned data and compacts the rest around it,
+ *                  leaving the hole below it in the freed bins. Use it for
+ *                  data whose pointer has to be given to something else (DMA,
+ *                  a callback) for a while. Unpin as soon as possible, every
+ *                  pinned index can leave a hole in the pool.
+ *
+ *                  Pinning is a flag, not a count: one tm_unpin unpins.
+ *                  tm_realloc can only shrink pinned data (or grow it at the
+ *                  top of the heap), otherwise it returns 0. This includes
+ *                  large objects (TM_LARGE_SIZE). tm_free unpins.
+ *
+ * \return          tm_pin: the pointer to the data, valid until tm_unpin
+ */
+void                *tm_pin(const tm_index_t index);
+void                tm_unpin(const tm_index_t index);
+#endif
+
+#ifdef TM_COMPRESS
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           Pointer to data that may be compressed (TM_COMPRESS)
+ *
+ *                  Data that is read with tm_access_p is tracked. Once it
+ *                  wasn't accessed for TM_COMPRESS_CYCLES calls to tm_thread,
+ *                  tm_thread compresses it and the space it saved is freed.
+ *                  The next tm_access_p decompresses it. Data that is never
+ *                  read with tm_access_p is never compressed.
+ *
+ *                  While data is compressed tm_void_p returns NULL and
+ *                  tm_sizeof its uncompressed size. tm_realloc and tm_pin
+ *                  decompress it first.
+ *
+ *                  tm_access_p of data that isn't compressed doesn't take
+ *                  the pool lock (TM_THREADSAFE). Like tm_void_p, use its
+ *                  pointer in a read section: compressing data bumps tm_seq.
+ *                  Decompressing takes the lock. If the data can't grow back
+ *                  where it is it gets new space and takes over its place in
+ *                  the index chain, which walks the chain up to both of them
+ *                  (O(indexes), while holding the lock). Data that is read
+ *                  often from several threads shouldn't be left to go cold.
+ *
+ * \return          tm_access_p: the pointer to the data, NULL if there was
+ *                  no room to decompress it (a defrag is requested)
+ */
+void                *tm_access_p(const tm_index_t index);
+bool                tm_compressed(const tm_index_t index);
+#endif
+
+#ifdef TM_REFCOUNT
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           Reference counts (TM_REFCOUNT)
+ *
+ *                  New data has one reference. tm_retain adds one (up to
+ *                  256 in total), tm_release drops one. When the last one is
+ *                  dropped the data is not freed right away: tm_thread frees
+ *                  up to TM_REFCOUNT_BATCH released indexes per call and
+ *                  joins them with the freed space around them in one pass.
+ *                  The index must not be used after its last release.
+ *
+ *                  tm_realloc never moves data that has more than one
+ *                  reference (it returns 0 instead). tm_free frees the data
+ *                  whatever its count.
+ *
+ * \return          tm_retain: index, or 0 if it has too many references
+ *                  tm_release: true if that was the last reference
+ *                  tm_refs: number of references, 0 if it is released
+ */
+tm_index_t          tm_retain(const tm_index_t index);
+bool                tm_release(const tm_index_t index);
+uint16_t            tm_refs(const tm_index_t index);
+#endif
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           Free space, in constant time
+ *
+ *                  The pool keeps which freed bins have data and the largest
+ *                  freed size of each bin up to date on every free, join,
+ *                  split and defrag step, so these don't walk the pool.
+ *
+ *                  tm_largest_free: bytes of the largest free extent, freed
+ *                      data or the top of the heap (not counting large
+ *                      objects). tm_alloc only takes freed data of a bin
+ *                      that any of its sizes fits, so that many bytes can
+ *                      still need a defrag
+ *                  tm_fragmentation: percent of the free memory that is not
+ *                      in the largest free extent (0 when it is all in one)
+ *                  tm_can_alloc: whether tm_alloc(size) would succeed now
+ */
+uint32_t            tm_largest_free();
+uint8_t             tm_fragmentation();
+bool                tm_can_alloc(tm_size_t size);
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           defrag backlog, from tm_defrag_progress
+ */
+typedef struct {
+    uint8_t         status;         //!< status bitcodes (TM_DEFRAG_IP while running)
+    uint32_t        freed_bytes;    //!< bytes in freed holes, recovered by a full defrag
+    uint32_t        remaining_bytes;//!< bytes of the heap the requested or running
+                                    //   defrag still has to walk over (0 if none)
+    uint32_t        largest_free;   //!< tm_largest_free()
+    uint8_t         fragmentation;  //!< tm_fragmentation()
+} tm_progress_t;
+
+/**
+ * \brief           how much work tm_thread has pending, to decide whether a
+ *                  defrag is worth running now
+ */
+tm_progress_t       tm_defrag_progress();
+
+#ifdef TM_STATS
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           Counters of the pool (TM_STATS)
+ *
+ *                  The bins and histograms are kept up to date as the pool
+ *                  is used, so tm_stats only copies them. Histogram bucket i
+ *                  counts the calls that took less than 2^i ns (and at least
+ *                  2^(i-1) ns), the last bucket also counts everything
+ *                  slower. Times include waiting for the pool lock.
+ *                  Everything restarts at tm_reset.
+ *
+ *                  See tinymem_stats.h to publish them to other processes.
+ */
+#define TM_STATS_BINS       (12)    //!< freed bins of the pool
+#define TM_STATS_BUCKETS    (24)    //!< histogram buckets, up to ~4ms
+
+typedef struct {
+    uint32_t        pool_bytes;                     //!< size of the pool
+    uint32_t        used_bytes;                     //!< allocated data
+    uint32_t        freed_bytes;                    //!< freed holes
+    uint32_t        heap_bytes;                     //!< left on the heap
+    uint32_t        indexes;                        //!< size of the index table
+    uint32_t        indexes_used;                   //!< allocated indexes
+    uint32_t        indexes_freed;                  //!< indexes of freed holes
+    tm_progress_t   progress;                       //!< tm_defrag_progress()
+    uint32_t        bin_count[TM_STATS_BINS];       //!< freed holes per bin
+    uint32_t        bin_bytes[TM_STATS_BINS];       //!< freed bytes per bin
+    uint32_t        alloc_ns[TM_STATS_BUCKETS];     //!< tm_alloc latency histogram
+    uint32_t        thread_ns[TM_STATS_BUCKETS];    //!< tm_thread latency histogram
+} tm_stats_t;
+
+void                tm_stats(tm_stats_t *stats);
+#endif
+
+#ifdef TM_TAGS
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           Per tag accounting (TM_TAGS)
+ *
+ *                  Every index has a tag: the one given to tm_alloc_tagged,
+ *                  0 for everything else. tm_realloc keeps the tag. The
+ *                  counters of each tag are kept up to date on every alloc,
+ *                  resize, free and defrag move, so reading them is cheap.
+ *                  allocs and frees measure churn, moved_bytes the defrag
+ *                  work the tag costs. All counters restart at tm_reset.
+ */
+typedef uint8_t     tm_tag_t;
+
+typedef struct {
+    uint32_t        live_bytes;     //!< bytes allocated now (tm_sizeof)
+    uint32_t        count;          //!< indexes allocated now
+    uint32_t        allocs;         //!< allocations since tm_reset
+    uint32_t        frees;          //!< frees since tm_reset
+    uint32_t        moved_bytes;    //!< bytes moved by defrag since tm_reset
+} tm_tag_stats_t;
+
+tm_index_t          tm_alloc_tagged(tm_size_t size, tm_tag_t tag);
+tm_tag_t            tm_tag(const tm_index_t index);
+tm_tag_stats_t      tm_tag_stats(tm_tag_t tag);
+#endif
+
+#ifdef TM_THREADSAFE
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           lock free reading of a shared pool
+ *
+ *                  tm_thread bumps tm_seq before and after it moves data
+ *                  (it is odd while data is moving). Readers copy what they
+ *                  need and retry if anything moved in the meantime:
+ *                      uint32_t seq;
+ *                      do{
+ *                          seq = tm_read_begin();
+ *                          value = ((my_type *)tm_void_p(index))->value;
+ *                      }while(tm_read_retry(seq));
+ *
+ *                  Only data is read inside of the loop, never written, and
+ *                  the index must not be freed by another thread meanwhile.
+ *                  What is read is only consistent once tm_read_retry says
+ *                  so: bound sizes and check for NULL before using them
+ *                  inside of the loop.
+ */
+extern uint32_t     tm_seq;
+
+static inline uint32_t tm_read_begin(){
+    uint32_t seq;
+    while((seq = __atomic_load_n(&tm_seq, __ATOMIC_ACQUIRE)) & 1);
+    return seq;
+}
+
+static inline bool  tm_read_retry(const uint32_t seq){
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&tm_seq, __ATOMIC_RELAXED) != seq;
+}
+#endif
+
+#ifdef TM_THREAD_POOLS
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           identifies the pool of a thread
+ *                  An index is only meaningful together with the pool it
+ *                  came from, so pass tm_owner() along with indexes that are
+ *                  given to other threads. The owner thread must outlive
+ *                  its indexes.
+ *
+ *                  Note: other threads can't read the data safely while the
+ *                  owner can call tm_thread. Hand over values, not pointers.
+ */
+typedef struct tm_owner *tm_owner_t;
+
+tm_owner_t          tm_owner();
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           free an index of any thread's pool
+ *                  If owner is another thread the index is queued without
+ *                  locking and freed by the owner's next tm_alloc or tm_thread
+ */
+void                tm_free_remote(tm_owner_t owner, const tm_index_t index);
+#endif
+
+#ifdef TM_PAGE_RELEASE
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           give unused memory in the pool back to the OS
+ *
+ *                  Releases the whole pages above the heap that were used
+ *                  since the last trim and the inside of the large freed
+ *                  holes that changed since then.
+ *                  tm_thread also trims the heap after a full defrag when
+ *                  it shrank by at least TM_TRIM_HYSTERESIS bytes.
+ *
+ * \return          bytes newly released
+ */
+uint32_t            tm_trim();
+#endif
 
 
 /*---------------------------------------------------------------------------*/
@@ -163,6 +496,7 @@ inline bool     tm_check(const tm_index_t index, const tm_size_t size);
 #ifdef TM_TESTS
 /*---------------------------------------------------------------------------*/
 /*      For Debug and Test                                                   */
+void                tdefrag();
 char*               test_tm_pool_new();
 char*               test_tm_pool_alloc();
 char*               test_tm_free_basic();
@@ -181,8 +515,50 @@ char                *test_tinymem(
         const bool threaded,
         uint32_t *defrags, uint32_t *fills, uint32_t *frees, uint32_t *purges
         );
+#ifdef TM_PAGE_RELEASE
+char                *test_tm_trim();
+#endif
+#ifdef TM_LARGE_SIZE
+char                *test_tm_large();
+#endif
+char                *test_tm_alloc_wait();
+char                *test_tm_defrag_resume();
+char                *test_tm_largest_free();
+#ifdef TM_CHECK_STEPS
+char                *test_tm_check();
+#endif
+#ifdef TM_PIN
+char                *test_tm_pin();
+#endif
+#ifdef TM_TAGS
+char                *test_tm_tags();
+#endif
+#ifdef TM_COMPRESS
+char                *test_tm_compress();
+#endif
+#ifdef TM_REFCOUNT
+char                *test_tm_refcount();
+#endif
+#ifdef TM_STATS
+char                *test_tm_stats();
+#endif
+#ifdef TM_DEFRAG_THREADS
+char                *test_tm_defrag_parallel();
+#endif
+#ifdef TM_INDEX_CHUNK
+char                *test_tm_index_grow();
+#endif
+#ifdef TM_THREADSAFE
+char                *test_tm_threadsafe();
+#endif
+#ifdef TM_THREAD_POOLS
+char                *test_tm_thread_pools();
+#endif
 #endif
 
+#ifdef __cplusplus
+}
+#endif
 
 #endif
 /** @} */
@@ -0,0 +1,218 @@
+#ifndef __tinymem_hpp
+#define __tinymem_hpp
+/*---------------------------------------------------------------------------*/
+/**
+ * \file            Typed C++ layer over tinymem.h (header only)
+ *
+ *                  handle<T>   owns one T in the pool and frees it when it
+ *                              goes out of scope
+ *                  vector<T>   growable array in the pool (tm_realloc)
+ *                  span<T>     pointer and length resolved once from an
+ *                              index, for use inside of a scope
+ *
+ *                  Handles and vectors are move only, so an index can only
+ *                  be freed once. tm_defrag moves data with a plain memory
+ *                  copy, so T must be trivially copyable. Data is only
+ *                  aligned on a block, so T can't need more (block_align).
+ *
+ *                  A span (or any pointer into the pool) is only valid until
+ *                  the next call to tm_thread or tm_realloc. Get it at the
+ *                  top of the hot code and let it go out of scope after.
+ */
+#include <new>
+#include <utility>
+#include <type_traits>
+#include "tinymem.h"
+
+namespace tinymem {
+
+/**
+ * \brief           alignment of data in the pool: that of a block
+ *                  (TM_BLOCK_TYPE in tinymem.c, at most 4 bytes)
+ */
+#ifdef TM_BLOCK_SIZE
+static constexpr size_t block_align = TM_BLOCK_SIZE < 4 ? TM_BLOCK_SIZE : 4;
+#else
+static constexpr size_t block_align = TM_INDEX_SIZE;    // two tm_index_t
+#endif
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           pointer and length of data in the pool
+ *                  Does not own the data. See the note about tm_thread above.
+ */
+template<typename T>
+class span {
+public:
+    span() : data_(nullptr), size_(0) {}
+    span(T *data, tm_size_t size) : data_(data), size_(size) {}
+
+    T *         data() const                { return data_; }
+    tm_size_t   size() const                { return size_; }
+    bool        empty() const               { return !size_; }
+    T &         operator[](tm_size_t i) const {
+        assert(i < size_);
+        return data_[i];
+    }
+    T *         begin() const               { return data_; }
+    T *         end() const                 { return data_ + size_; }
+
+private:
+    T           *data_;
+    tm_size_t   size_;
+};
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           owning handle to one T in the pool
+ *                  Create it with handle<T>::make(args...). The handle is
+ *                  empty (false) if the pool could not allocate it.
+ */
+template<typename T>
+class handle {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "tm_defrag moves data with a memory copy");
+    static_assert(alignof(T) <= block_align, "T needs more alignment than the pool's blocks");
+public:
+    handle() : index_(0) {}
+    /**
+     * \brief       take ownership of an index from tm_alloc
+     */
+    explicit handle(tm_index_t index) : index_(index) {
+        assert(!index || (tm_valid(index) && tm_sizeof(index) >= sizeof(T)));
+    }
+    handle(handle &&other) noexcept : index_(other.release()) {}
+    handle & operator=(handle &&other) noexcept {
+        reset(other.release());
+        return *this;
+    }
+    handle(const handle &) = delete;
+    handle & operator=(const handle &) = delete;
+    ~handle()                               { reset(); }
+
+    template<typename... Args>
+    static handle make(Args&&... args){
+        tm_index_t index = tm_alloc(sizeof(T));
+        if(!index) return handle();
+        new (tm_void_p(index)) T(std::forward<Args>(args)...);
+        return handle(index);
+    }
+
+    tm_index_t  index() const               { return index_; }
+    explicit operator bool() const          { return index_ != 0; }
+
+    /**
+     * \brief       give up ownership without freeing the index
+     */
+    tm_index_t  release(){
+        tm_index_t index = index_;
+        index_ = 0;
+        return index;
+    }
+    void        reset(tm_index_t index = 0){
+        tm_free(index_);
+        index_ = index;
+    }
+
+    /**
+     * \brief       resolve the pointer. Do not keep it past tm_thread
+     */
+    T *         get() const                 { return static_cast<T *>(tm_void_p(index_)); }
+    T &         operator*() const           { return *get(); }
+    T *         operator->() const          { return get(); }
+    span<T>     access() const              { return span<T>(get(), index_ ? 1 : 0); }
+
+private:
+    tm_index_t  index_;
+};
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           growable array of T in the pool
+ *                  Growing uses tm_realloc, which extends the data in place
+ *                  when it is at the top of the heap or next to freed data.
+ *                  Functions that allocate return false if the pool is full.
+ */
+template<typename T>
+class vector {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "tm_defrag moves data with a memory copy");
+    static_assert(alignof(T) <= block_align, "T needs more alignment than the pool's blocks");
+public:
+    vector() : index_(0), size_(0) {}
+    vector(vector &&other) noexcept : index_(other.index_), size_(other.size_) {
+        other.index_ = 0;
+        other.size_ = 0;
+    }
+    vector & operator=(vector &&other) noexcept {
+        std::swap(index_, other.index_);
+        std::swap(size_, other.size_);
+        return *this;
+    }
+    vector(const vector &) = delete;
+    vector & operator=(const vector &) = delete;
+    ~vector()                               { tm_free(index_); }
+
+    tm_index_t  index() const               { return index_; }
+    tm_size_t   size() const                { return size_; }
+    bool        empty() const               { return !size_; }
+    tm_size_t   capacity() const {
+        return index_ ? tm_sizeof(index_) / sizeof(T) : 0;
+    }
+
+    bool        reserve(tm_size_t count){
+        tm_index_t index;
+        if(count <= capacity()) return true;
+        index = tm_realloc(index_, count * sizeof(T));
+        if(!index) return false;
+        index_ = index;
+        return true;
+    }
+    bool        resize(tm_size_t count, const T &value = T()){
+        // value can be in the data, which growing moves or frees
+        T copy = value;
+        tm_size_t i;
+        if(!reserve(count)) return false;
+        T *data = get();
+        for(i=size_; i<count; i++) data[i] = copy;
+        size_ = count;
+        return true;
+    }
+    bool        push_back(const T &value){
+        T copy = value;                     // see resize
+        if(size_ == capacity() && !reserve(size_ ? size_ * 2 : 4)) return false;
+        get()[size_++] = copy;
+        return true;
+    }
+    void        pop_back()                  { assert(size_); size_--; }
+    void        clear()                     { size_ = 0; }
+
+    /**
+     * \brief       give the unused capacity back to the pool
+     */
+    void        shrink_to_fit(){
+        if(!size_){
+            tm_free(index_);
+            index_ = 0;
+        } else if(size_ < capacity()){
+            // shrinking can only fail if there are no indexes left
+            tm_index_t index = tm_realloc(index_, size_ * sizeof(T));
+            if(index) index_ = index;
+        }
+    }
+
+    T *         get() const                 { return static_cast<T *>(tm_void_p(index_)); }
+    T &         operator[](tm_size_t i) const {
+        assert(i < size_);
+        return get()[i];
+    }
+    span<T>     access() const              { return span<T>(get(), size_); }
+
+private:
+    tm_index_t  index_;
+    tm_size_t   size_;
+};
+
+}   // namespace tinymem
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef __tinymem_async_hpp
+#define __tinymem_async_hpp
+/*---------------------------------------------------------------------------*/
+/**
+ * \file            Allocation that awaits defrag in C++20 coroutines
+ *
+ *                  loop        minimal event loop. poll() resumes the ready
+ *                              coroutines and runs one tm_thread slice
+ *                  task        fire and forget coroutine type for the loop
+ *
+ *                  co_await loop.alloc(size) returns right away if tm_alloc
+ *                  succeeds. If the pool is fragmented the coroutine is
+ *                  suspended and poll() keeps running defrag slices between
+ *                  the other tasks. It is resumed with a valid index once
+ *                  there is room, so allocation never blocks the loop:
+ *
+ *                      tinymem::task worker(tinymem::loop &loop){
+ *                          tm_index_t index = co_await loop.alloc(1000);
+ *                          ...
+ *                      }
+ *                      worker(loop);
+ *                      while(loop.poll());
+ *
+ *                  Waiters are served in order. A size bigger than the pool
+ *                  can never fit: it returns 0 right away instead of
+ *                  waiting. A waiter that fits the pool but not the data in
+ *                  it waits until enough data is freed. As always, pointers
+ *                  into the pool are not valid across a co_await (poll()
+ *                  moves data).
+ */
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include "tinymem.h"
+
+namespace tinymem {
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           coroutine that starts when it is called and destroys
+ *                  itself when it is done
+ */
+struct task {
+    struct promise_type {
+        task                get_return_object()     { return task(); }
+        std::suspend_never  initial_suspend()       { return {}; }
+        std::suspend_never  final_suspend() noexcept { return {}; }
+        void                return_void()           {}
+        void                unhandled_exception()   { std::terminate(); }
+    };
+};
+
+/*---------------------------------------------------------------------------*/
+class loop {
+public:
+    /**
+     * \brief       awaitable returned by alloc()
+     */
+    class alloc_awaiter {
+    public:
+        alloc_awaiter(loop &owner, tm_size_t size) :
+            owner_(owner), size_(size), index_(0) {}
+
+        bool        await_ready(){
+            // don't wait for what no defrag can give, and don't pass the
+            //      coroutines that are already waiting
+            if(!fits_pool(size_)) return true;
+            if(owner_.waiters_.empty()) index_ = tm_alloc(size_);
+            return index_ != 0;
+        }
+        void        await_suspend(std::coroutine_handle<> handle){
+            handle_ = handle;
+            owner_.waiters_.push_back(this);
+        }
+        tm_index_t  await_resume() const        { return index_; }
+
+    private:
+        friend class loop;
+        static bool fits_pool(tm_size_t size){
+#ifdef TM_LARGE_SIZE
+            if(size >= TM_LARGE_SIZE) return true;  // not in the pool
+#endif
+            return size <= TM_POOL_SIZE;
+        }
+
+        loop                    &owner_;
+        tm_size_t               size_;
+        tm_index_t              index_;
+        std::coroutine_handle<> handle_;
+    };
+
+    loop() = default;
+    loop(const loop &) = delete;
+    loop & operator=(const loop &) = delete;
+
+    /**
+     * \brief       co_await to get an index of size bytes
+     */
+    alloc_awaiter   alloc(tm_size_t size)       { return alloc_awaiter(*this, size); }
+
+    /**
+     * \brief       resume handle on the next poll()
+     */
+    void        post(std::coroutine_handle<> handle){ ready_.push_back(handle); }
+
+    /**
+     * \brief       co_await loop.yield() to let the other tasks run
+     */
+    auto        yield(){
+        struct awaiter {
+            loop        &owner;
+            bool        await_ready() const     { return false; }
+            void        await_suspend(std::coroutine_handle<> h){ owner.post(h); }
+            void        await_resume() const    {}
+        };
+        return awaiter{*this};
+    }
+
+    /**
+     * \brief       one iteration of the loop: resume the coroutines that were
+     *              ready, run one tm_thread slice and hand out the memory
+     *              that is available to the waiters
+     * \return      true if there is still work (ready tasks, waiters or
+     *              defrag)
+     */
+    bool        poll(){
+        std::deque<std::coroutine_handle<> >::size_type n = ready_.size();
+        bool threaded;
+        while(n--){
+            std::coroutine_handle<> handle = ready_.front();
+            ready_.pop_front();
+            handle.resume();
+        }
+        threaded = tm_thread();
+        while(!waiters_.empty()){
+            alloc_awaiter *waiter = waiters_.front();
+            waiter->index_ = tm_alloc(waiter->size_);
+            if(!waiter->index_) break;      // tm_alloc requested a defrag
+            waiters_.pop_front();
+            ready_.push_back(waiter->handle_);
+        }
+        return threaded || !ready_.empty() || !waiters_.empty();
+    }
+
+    std::size_t waiting() const                 { return waiters_.size(); }
+
+private:
+    std::deque<std::coroutine_handle<> >    ready_;
+    std::deque<alloc_awaiter *>             waiters_;
+};
+
+}   // namespace tinymem
+
+#endif
@@ -0,0 +1,240 @@
+#include "tinymem_ds.h"
+
+#ifndef TM_TOOLS
+#define assert(ignore)((void) 0)
+#endif
+
+#define TESTprint(...)      printf(__VA_ARGS__)
+
+/*---------------------------------------------------------------------------*/
+/*      List                                                                 */
+
+void            tm_list_push_back(tm_list *list, const tm_index_t index){
+    tm_list_insert_after(list, list->last, index);
+}
+
+void            tm_list_push_front(tm_list *list, const tm_index_t index){
+    tm_list_insert_after(list, 0, index);
+}
+
+void            tm_list_insert_after(tm_list *list, const tm_index_t after,
+                                     const tm_index_t index){
+    tm_list_node *node = tm_list_node_p(index);
+    assert(node);
+    node->prev = after;
+    node->next = after ? tm_list_next(after) : list->first;
+    if(node->next)  tm_list_prev(node->next) = index;
+    else            list->last = index;
+    if(after)       tm_list_next(after) = index;
+    else            list->first = index;
+}
+
+void            tm_list_remove(tm_list *list, const tm_index_t index){
+    tm_list_node *node = tm_list_node_p(index);
+    assert(node);
+    if(node->prev)  tm_list_next(node->prev) = node->next;
+    else            list->first = node->next;
+    if(node->next)  tm_list_prev(node->next) = node->prev;
+    else            list->last = node->prev;
+    node->prev = 0;
+    node->next = 0;
+}
+
+void            tm_list_free(tm_list *list){
+    tm_index_t index = list->first, next;
+    while(index){
+        next = tm_list_next(index);
+        tm_free(index);
+        index = next;
+    }
+    list->first = 0;
+    list->last = 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/*      Hash map                                                             */
+
+#define MAP_ENTRY(index)        ((tm_map_entry *)tm_void_p(index))
+#define MAP_BUCKETS(map)        ((tm_index_t *)tm_void_p((map)->buckets))
+
+static inline tm_size_t map_bucket(const tm_size_t size, const uint32_t key){
+    // fibonacci hashing, the upper bits are folded down for small tables
+    uint32_t hash = key * 2654435769u;
+    return (tm_size_t)(hash ^ (hash >> 16)) & (size - 1);
+}
+
+bool            tm_map_init(tm_map *map, tm_size_t size, const tm_size_t value_size){
+    tm_size_t s = 1;
+    while(s < size) s <<= 1;
+    map->buckets = tm_alloc(s * sizeof(tm_index_t));
+    if(!map->buckets) return false;
+    memset(tm_void_p(map->buckets), 0, s * sizeof(tm_index_t));
+    map->size = s;
+    map->count = 0;
+    map->value_size = value_size;
+    return true;
+}
+
+tm_index_t      tm_map_get(const tm_map *map, const uint32_t key){
+    tm_index_t index = MAP_BUCKETS(map)[map_bucket(map->size, key)];
+    while(index){
+        if(MAP_ENTRY(index)->key == key) return index;
+        index = MAP_ENTRY(index)->next;
+    }
+    return 0;
+}
+
+static void     map_grow(tm_map *map){
+    // double the bucket table. If the pool is full the chains just get longer
+    tm_size_t size = map->size * 2, i, bucket;
+    tm_index_t *buckets, *old, index, next;
+    tm_index_t new_buckets = tm_alloc(size * sizeof(tm_index_t));
+    if(!new_buckets) return;
+    buckets = (tm_index_t *)tm_void_p(new_buckets);
+    old = MAP_BUCKETS(map);
+    memset(buckets, 0, size * sizeof(tm_index_t));
+    for(i=0; i<map->size; i++){
+        for(index=old[i]; index; index=next){
+            next = MAP_ENTRY(index)->next;
+            bucket = map_bucket(size, MAP_ENTRY(index)->key);
+            MAP_ENTRY(index)->next = buckets[bucket];
+            buckets[bucket] = index;
+        }
+    }
+    tm_free(map->buckets);
+    map->buckets = new_buckets;
+    map->size = size;
+}
+
+tm_index_t      tm_map_put(tm_map *map, const uint32_t key){
+    tm_index_t *bucket;
+    tm_index_t index = tm_map_get(map, key);
+    if(index) return index;
+    index = tm_alloc(sizeof(tm_map_entry) + map->value_size);
+    if(!index) return 0;
+    bucket = MAP_BUCKETS(map) + map_bucket(map->size, key);
+    *MAP_ENTRY(index) = (tm_map_entry) {.key = key, .next = *bucket};
+    *bucket = index;
+    map->count++;
+    if(map->count > map->size) map_grow(map);
+    return index;
+}
+
+bool            tm_map_remove(tm_map *map, const uint32_t key){
+    tm_index_t *link = MAP_BUCKETS(map) + map_bucket(map->size, key);
+    tm_index_t index;
+    while(*link){
+        index = *link;
+        if(MAP_ENTRY(index)->key == key){
+            *link = MAP_ENTRY(index)->next;
+            tm_free(index);     // doesn't move data, link stays valid
+            map->count--;
+            return true;
+        }
+        link = &MAP_ENTRY(index)->next;
+    }
+    return false;
+}
+
+void            tm_map_free(tm_map *map){
+    tm_size_t i;
+    tm_index_t index, next;
+    for(i=0; i<map->size; i++){
+        for(index=MAP_BUCKETS(map)[i]; index; index=next){
+            next = MAP_ENTRY(index)->next;
+            tm_free(index);
+        }
+    }
+    tm_free(map->buckets);
+    map->buckets = 0;
+    map->size = 0;
+    map->count = 0;
+}
+
+#ifdef TM_TESTS
+/*---------------------------------------------------------------------------*/
+/*      Tests                                                                */
+#define mu_assert(test) if (!(test)) {TESTprint("MU ASSERT FAILED(%s,%u): \"%s\"\n", \
+        __FILE__, __LINE__, #test); return "FAILED\n";}
+
+#define TEST_NODES      (200)
+
+typedef struct {
+    tm_list_node    node;
+    uint32_t        value;
+} test_node;
+
+/**
+ * The links of a list must stay valid through a full defrag
+ */
+char *test_tm_list(){
+    tm_list list = {0};
+    tm_index_t index, next, holes[TEST_NODES];
+    uint32_t i;
+    tm_reset();
+    for(i=0; i<TEST_NODES; i++){
+        holes[i] = tm_alloc(16);            // freed below to make holes
+        index = tm_alloc(sizeof(test_node));
+        mu_assert(index);
+        ((test_node *)tm_void_p(index))->value = i;
+        if(i % 2)   tm_list_push_back(&list, index);
+        else        tm_list_push_front(&list, index);
+    }
+    for(i=0; i<TEST_NODES; i++) tm_free(holes[i]);
+    // remove every node divisible by 3
+    for(index=list.first; index; index=next){
+        next = tm_list_next(index);
+        if(!(((test_node *)tm_void_p(index))->value % 3)){
+            tm_list_remove(&list, index);
+            tm_free(index);
+        }
+    }
+    tdefrag();
+
+    // front: even values descending, back: odd values ascending
+    i = 0;
+    for(index=list.first; index; index=tm_list_next(index)){
+        mu_assert(((test_node *)tm_void_p(index))->value % 3);
+        if(tm_list_next(index)) mu_assert(tm_list_prev(tm_list_next(index)) == index);
+        i++;
+    }
+    mu_assert(i == TEST_NODES - (TEST_NODES + 2) / 3);
+    index = list.last;
+    mu_assert(((test_node *)tm_void_p(index))->value == TEST_NODES - 1);
+    tm_list_free(&list);
+    mu_assert(!list.first && !list.last);
+    return NULL;
+}
+
+/**
+ * Entries must be found after the table grew and after a full defrag
+ */
+char *test_tm_map(){
+    tm_map map;
+    tm_index_t entry;
+    uint32_t i;
+    tm_reset();
+    mu_assert(tm_map_init(&map, 4, sizeof(uint32_t)));
+    for(i=0; i<1000; i++){
+        entry = tm_map_put(&map, i * 7919);
+        mu_assert(entry);
+        *(uint32_t *)tm_map_value_p(entry) = i;
+    }
+    mu_assert(map.count == 1000 && map.size >= 1000);
+    mu_assert(tm_map_put(&map, 7919) == tm_map_get(&map, 7919));
+    for(i=0; i<1000; i+=2) mu_assert(tm_map_remove(&map, i * 7919));
+    mu_assert(!tm_map_remove(&map, 0));
+    mu_assert(map.count == 500);
+
+    tdefrag();
+    for(i=0; i<1000; i++){
+        entry = tm_map_get(&map, i * 7919);
+        if(i % 2){
+            mu_assert(entry && *(uint32_t *)tm_map_value_p(entry) == i);
+        } else mu_assert(!entry);
+    }
+    tm_map_free(&map);
+    mu_assert(!map.buckets);
+    return NULL;
+}
+#endif
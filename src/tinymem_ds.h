@@ -0,0 +1,136 @@
+#ifndef __tinymem_ds_h
+#define __tinymem_ds_h
+/*---------------------------------------------------------------------------*/
+/**
+ * \file            Containers linked by tm_index_t
+ *
+ *                  The nodes of these containers live in the pool and are
+ *                  linked with tm_index_t instead of pointers. A link is 1 or
+ *                  2 bytes instead of 8, and because indexes never change the
+ *                  containers survive tm_thread (defrag) without any fixups.
+ *
+ *                  As everywhere else, pointers from tm_void_p (or from
+ *                  tm_map_value_p) must not be kept past tm_thread.
+ */
+#include "tinymem.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           Intrusive doubly linked list
+ *
+ *                  A node is any pool allocation that starts with a
+ *                  tm_list_node:
+ *                      typedef struct {
+ *                          tm_list_node    node;   // must be first
+ *                          uint32_t        value;
+ *                      } my_node;
+ *
+ *                      tm_list list = {0};
+ *                      tm_index_t index = tm_alloc(sizeof(my_node));
+ *                      tm_list_push_back(&list, index);
+ *                      for(index=list.first; index; index=tm_list_next(index)){...}
+ */
+typedef struct {
+    tm_index_t      prev;
+    tm_index_t      next;
+} tm_list_node;
+
+typedef struct {
+    tm_index_t      first;
+    tm_index_t      last;
+} tm_list;
+
+#define tm_list_node_p(index)   ((tm_list_node *)tm_void_p(index))
+#define tm_list_next(index)     (tm_list_node_p(index)->next)
+#define tm_list_prev(index)     (tm_list_node_p(index)->prev)
+
+void                tm_list_push_back(tm_list *list, const tm_index_t index);
+void                tm_list_push_front(tm_list *list, const tm_index_t index);
+
+/**
+ * \brief           insert index after the node after (at the front if 0)
+ */
+void                tm_list_insert_after(tm_list *list, const tm_index_t after,
+                                         const tm_index_t index);
+
+/**
+ * \brief           unlink index from the list. It is not freed
+ */
+void                tm_list_remove(tm_list *list, const tm_index_t index);
+
+/**
+ * \brief           unlink and tm_free every node
+ */
+void                tm_list_free(tm_list *list);
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           Hash map of uint32_t keys to values of a fixed size
+ *
+ *                  The bucket table and every entry are pool allocations.
+ *                  Entries are chained with tm_index_t and hold their value
+ *                  right after the key:
+ *                      tm_map map;
+ *                      tm_map_init(&map, 64, sizeof(my_value));
+ *                      tm_index_t entry = tm_map_put(&map, key);
+ *                      my_value *v = (my_value *)tm_map_value_p(entry);
+ *
+ *                  The table doubles when there are more entries than
+ *                  buckets. Functions that allocate return 0 or false if the
+ *                  pool is full, so call tm_thread and try again.
+ */
+typedef struct {
+    uint32_t        key;
+    tm_index_t      next;       // next entry in the bucket
+} tm_map_entry;
+
+typedef struct {
+    tm_index_t      buckets;    // index of the tm_index_t[] bucket table
+    tm_size_t       size;       // number of buckets (a power of 2)
+    tm_size_t       count;      // number of entries
+    tm_size_t       value_size; // bytes of every value
+} tm_map;
+
+#define tm_map_value_p(entry)   ((void *)((tm_map_entry *)tm_void_p(entry) + 1))
+
+/**
+ * \brief           allocate the bucket table. size is rounded up to a power of 2
+ */
+bool                tm_map_init(tm_map *map, tm_size_t size, const tm_size_t value_size);
+
+/**
+ * \return          the entry of key, or 0 if it is not in the map
+ */
+tm_index_t          tm_map_get(const tm_map *map, const uint32_t key);
+
+/**
+ * \return          the entry of key, allocated if it is not in the map
+ *                  (the value of a new entry is uninitialized)
+ *                  0 if the pool is full
+ */
+tm_index_t          tm_map_put(tm_map *map, const uint32_t key);
+
+/**
+ * \return          true if key was in the map. Its entry is freed
+ */
+bool                tm_map_remove(tm_map *map, const uint32_t key);
+
+/**
+ * \brief           free the bucket table and all entries
+ */
+void                tm_map_free(tm_map *map);
+
+#ifdef TM_TESTS
+char                *test_tm_list();
+char                *test_tm_map();
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
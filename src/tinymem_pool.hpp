@@ -0,0 +1,839 @@
+#ifndef __tinymem_pool_hpp
+#define __tinymem_pool_hpp
+/*---------------------------------------------------------------------------*/
+/**
+ * \file            Compile time specialized pools (header only)
+ *
+ *                  tinymem.c is configured with the macros in
+ *                  tinymem_platform.h, so a program can only have one pool.
+ *                  Pool<PoolConfig<...>> is the same allocator as a template:
+ *                  block size, pool size, number of indexes, index type and
+ *                  defrag policy are template parameters, and the types that
+ *                  tinymem.c picks with #if chains are derived from them.
+ *
+ *                  Several differently tuned pools can live in one program:
+ *                      typedef tinymem::PoolConfig<4, 4096, 128> SmallConfig;
+ *                      static tinymem::Pool<SmallConfig> small;
+ *                      uint8_t index = small.alloc(20);
+ *                      ...
+ *                      small.thread();     // in the main loop
+ *
+ *                  SegmentedPool<Config, MaxSegments> chains pools of the same
+ *                  config, so that capacity follows demand.
+ *
+ *                  The optional features of tinymem.c (nursery, large
+ *                  objects, trimming, ...) are not part of the template.
+ */
+#include <stddef.h>
+#include <string.h>
+#include <limits>
+#include <new>
+#include <type_traits>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+#include "tinymem.h"
+
+namespace tinymem {
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           smallest unsigned type that can hold max
+ */
+template<size_t max>
+struct uint_fit {
+    typedef typename std::conditional<(max <= UINT8_MAX), uint8_t,
+            typename std::conditional<(max <= UINT16_MAX), uint16_t,
+            uint32_t>::type>::type type;
+};
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           Defrag policies
+ *                  slice_clocks    budget of one call to thread() (estimated
+ *                                  cpu clocks, like TM_THREAD_TIME_US)
+ *                  heap_percent    thread() requests a defrag at this % heap
+ *                  index_percent   ... or at this % used indexes
+ *                  min_percent     ... if at least this % is freed
+ */
+template<int32_t SliceClocks, uint8_t HeapPercent = TM_DEFRAG_SIZE,
+         uint8_t IndexPercent = TM_DEFRAG_INDEXES, uint8_t MinPercent = TM_DEFRAG_MIN>
+struct DefragPolicy {
+    static constexpr int32_t    slice_clocks = SliceClocks;
+    static constexpr uint8_t    heap_percent = HeapPercent;
+    static constexpr uint8_t    index_percent = IndexPercent;
+    static constexpr uint8_t    min_percent = MinPercent;
+};
+
+typedef DefragPolicy<1400>      DefragIncremental;  // ~2us at 700MHz, as tinymem.c
+typedef DefragPolicy<INT32_MAX> DefragBlocking;     // a defrag always finishes
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           Pool configuration
+ *
+ * \param BlockSize bytes per block, at least 2 * sizeof(Index)
+ * \param PoolSize  bytes in the pool, divisible by BlockSize
+ * \param Indexes   number of indexes, divisible by the bits in an int
+ * \param Index     type of an index, defaults to the smallest that fits
+ * \param Defrag    defrag policy
+ */
+template<size_t BlockSize, size_t PoolSize, size_t Indexes,
+         typename Index = typename uint_fit<Indexes - 1>::type,
+         typename Defrag = DefragIncremental>
+struct PoolConfig {
+    static constexpr size_t     block_size = BlockSize;
+    static constexpr size_t     pool_size = PoolSize;
+    static constexpr size_t     pool_blocks = PoolSize / BlockSize;
+    static constexpr size_t     indexes = Indexes;
+
+    typedef Index                                       index_t;
+    typedef typename uint_fit<pool_blocks>::type        blocks_t;   // tm_blocks_t
+    typedef typename uint_fit<Indexes>::type            count_t;    // counts of indexes
+    typedef Defrag                                      defrag;
+
+    // TM_BLOCK_TYPE: data is aligned on whole blocks
+    struct alignas(BlockSize < 16 ? BlockSize : 16) block_t {
+        uint8_t bytes[BlockSize];
+    };
+
+    static_assert(std::is_unsigned<Index>::value, "index type must be unsigned");
+    static_assert(Indexes - 1 <= std::numeric_limits<Index>::max(), "too many indexes for index type");
+    static_assert(BlockSize >= 2 * sizeof(Index), "block size must be 2 times bigger than index size");
+    static_assert((BlockSize & (BlockSize - 1)) == 0, "block size must be a power of 2");
+    static_assert(PoolSize % BlockSize == 0, "pool size must be divisible by block size");
+    static_assert(pool_blocks <= UINT32_MAX, "pool is too large");
+    static_assert(Indexes % (8 * sizeof(unsigned int)) == 0, "indexes must be divisible by int bits");
+};
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           A memory pool. The methods are the same as the tm_*
+ *                  functions in tinymem.h.
+ *                  The pool is large, it should be static or global.
+ */
+template<typename Config>
+class Pool {
+public:
+    typedef typename Config::index_t    index_t;
+    typedef typename Config::blocks_t   blocks_t;
+    typedef typename Config::count_t    count_t;
+    typedef typename Config::block_t    block_t;
+    typedef typename Config::defrag     defrag_policy;
+
+    static constexpr size_t     block_size = Config::block_size;
+    static constexpr size_t     pool_blocks = Config::pool_blocks;
+    static constexpr size_t     indexes = Config::indexes;
+
+    Pool()                                  { reset(); }
+    Pool(const Pool &) = delete;
+    Pool & operator=(const Pool &) = delete;
+
+    /*-----------------------------------------------------------------------*/
+    /**
+     * \brief       Completely resets the pool. ALL DATA WILL BE LOST
+     */
+    void        reset(){
+        size_t i;
+        for(i=0; i<bit_words; i++){ filled[i] = 0; points[i] = 0; }
+        for(i=0; i<freed_bins; i++) freed[i] = 0;
+        filled[0] = 1; points[0] = 1;   // NULL is taken
+        pointers[0] = poolptr{0, 0};    // heap = 0
+        filled_blocks = 0;
+        freed_blocks = 0;
+        ptrs_filled = 1;                // NULL is "filled"
+        ptrs_freed = 0;
+        find_index_word = 0;
+        first_index = 0;
+        last_index = 0;
+        status_ = 0;
+        defrag_index = 0;
+        defrag_prev = 0;
+    }
+
+    /*-----------------------------------------------------------------------*/
+    size_t      size_of(const index_t index) const {
+        return (size_t)BLOCKS(index) * block_size;
+    }
+
+    void *      void_p(const index_t index){
+        // Note: index 0 has location == heap
+        if(LOCATION(index) >= HEAP()) return NULL;
+        return pool + LOCATION(index);
+    }
+
+    bool        valid(const index_t index) const {
+        if(index >= indexes)                    return false;
+        if(LOCATION(index) >= pool_blocks)      return false;
+        return POINTS(index) && FILLED(index);
+    }
+
+    bool        check(const index_t index, const size_t size) const {
+        return valid(index) && size_of(index) == size;
+    }
+
+    uint8_t     status() const                  { return status_; }
+    size_t      bytes_left() const              { return BLOCKS_LEFT() * block_size; }
+
+    /*-----------------------------------------------------------------------*/
+    index_t     alloc(const size_t size){
+        index_t index;
+        blocks_t blocks;
+        if(!size || size > Config::pool_size) return 0;
+        blocks = align_blocks(size);
+        if(BLOCKS_LEFT() < blocks) return 0;
+        index = freed_get(blocks);
+        if(index){
+            if(BLOCKS(index) != blocks){ // Split the index if it is too big
+                if(!index_split(index, blocks, 0)){
+                    // Split can fail if there are not enough pointers
+                    free(index);
+                    status_ |= TM_DEFRAG_FAST;  // need more indexes
+                    return 0;
+                }
+            }
+            return index;
+        }
+        if(HEAP_LEFT() < blocks){
+            status_ |= TM_DEFRAG_FAST;          // need less fragmentation
+            return 0;
+        }
+        if(ptrs_filled >= indexes) return 0;
+        index = find_index();
+        if(!index){
+            status_ |= TM_DEFRAG_FAST;          // need more indexes
+            return 0;
+        }
+        index_extend(index, blocks);
+        return index;
+    }
+
+    /*-----------------------------------------------------------------------*/
+    index_t     realloc(const index_t index, const size_t size){
+        index_t new_index;
+        blocks_t blocks, prev_blocks;
+        if(!index) return alloc(size);
+        if(!FILLED(index)) return 0;
+        if(!size){
+            free(index);
+            return 0;
+        }
+        if(size > Config::pool_size) return 0;
+        blocks = align_blocks(size);
+        if(!FILLED(NEXT(index))){
+            // If next index is free, always join it first
+            index_join(index, NEXT(index), NULL);
+        }
+        prev_blocks = BLOCKS(index);
+        if(blocks == prev_blocks) return index;
+        if(blocks < prev_blocks){   // shrink data
+            if(!index_split(index, blocks, 0)) return 0;
+            return index;
+        }
+        if(!NEXT(index) && !(status_ & TM_DEFRAG_IP) && HEAP_LEFT() >= blocks - prev_blocks){
+            // the index is at the top of the heap, grow it in place
+            HEAP() += blocks - prev_blocks;
+            filled_blocks += blocks - prev_blocks;
+            return index;
+        }
+        new_index = alloc(size);
+        if(!new_index) return 0;
+        memmove(void_p(new_index), void_p(index), size_of(index));
+        free(index);
+        return new_index;
+    }
+
+    /*-----------------------------------------------------------------------*/
+    void        free(const index_t index){
+        if(!index) return;
+        assert(LOCATION(index) < HEAP());
+        assert(index < indexes);
+        assert(FILLED(index));
+        FILLED_CLEAR(index);
+        filled_blocks -= BLOCKS(index);
+        freed_blocks += BLOCKS(index);
+        ptrs_filled--;
+        ptrs_freed++;
+        freed_insert(index);
+        // Join all the way up if next index is free
+        if(!FILLED(NEXT(index))) index_join(index, NEXT(index), NULL);
+    }
+
+    /*-----------------------------------------------------------------------*/
+    /**
+     * \brief       run the memory manager for a short stint of time
+     * \return      true if there is more work to do
+     */
+    bool        thread(){
+        if(status_ & TM_ANY_DEFRAG) return defrag();
+        if((uint64_t)HEAP() * 100 / pool_blocks >= defrag_policy::heap_percent){
+            // check if there are blocks to be recovered
+            if((uint64_t)freed_blocks * 100 / (filled_blocks + freed_blocks)
+                    >= defrag_policy::min_percent){
+                status_ |= TM_DEFRAG_FAST;
+            }
+            return true;
+        }
+        if((uint64_t)PTRS_USED() * 100 / indexes >= defrag_policy::index_percent){
+            // check if there are indexes to be recovered
+            if((uint64_t)ptrs_freed * 100 / (ptrs_filled + ptrs_freed)
+                    >= defrag_policy::min_percent){
+                status_ |= TM_DEFRAG_FAST;
+            }
+            return true;
+        }
+        return false;
+    }
+
+#ifdef TM_TOOLS
+    /*-----------------------------------------------------------------------*/
+    /**
+     * \brief       check all of the pool's bookkeeping (slow)
+     */
+    bool        isvalid() const {
+        size_t filled_count = 0, freed_count = 0, ptrs_filled_count = 1, ptrs_freed_count = 0;
+        size_t index, bin_count = 0;
+        index_t i;
+        uint8_t bin;
+        for(bin=0; bin<freed_bins; bin++){
+            for(i=freed[bin]; i; i=free_p(i)->next){
+                if(FILLED(i) || !POINTS(i))         return false;
+                if(freed_bin(BLOCKS(i)) != bin)     return false;
+                bin_count++;
+            }
+        }
+        for(index=first_index; index; index=NEXT(index)){
+            if(!POINTS(index))                      return false;
+            if(LOCATION(index) > LOCATION(NEXT(index)) && NEXT(index)) return false;
+            if(FILLED(index))   {filled_count += BLOCKS(index); ptrs_filled_count++;}
+            else                {freed_count += BLOCKS(index); ptrs_freed_count++;}
+        }
+        if(bin_count != ptrs_freed)                 return false;
+        if(filled_count != filled_blocks || freed_count != freed_blocks) return false;
+        return ptrs_filled_count == ptrs_filled && ptrs_freed_count == ptrs_freed;
+    }
+#endif
+
+private:
+    struct poolptr {
+        blocks_t    loc;
+        index_t     next;
+    };
+    struct free_block {         // stored INSIDE of freed memory
+        index_t     prev;
+        index_t     next;
+    };
+
+    static constexpr uint8_t    freed_bins = 12;
+    static constexpr size_t     int_bits = sizeof(unsigned int) * 8;
+    static constexpr size_t     bit_words = indexes / int_bits;
+
+    // Used in defrag to subtract from clocks_left
+    static constexpr int32_t    index_remove_clocks = 10;
+    static constexpr int32_t    freed_remove_clocks = 8;
+    static constexpr int32_t    split_clocks = 20;
+
+    block_t         pool[pool_blocks];          //!< Actual memory pool
+    unsigned int    filled[bit_words];          //!< bit array of filled pointers
+    unsigned int    points[bit_words];          //!< bit array of used pointers
+    poolptr         pointers[indexes];          //!< index lookup location
+    index_t         freed[freed_bins];          //!< binned storage of freed indexes
+    blocks_t        filled_blocks;              //!< total amount of data allocated
+    blocks_t        freed_blocks;               //!< total amount of data freed
+    count_t         ptrs_filled;                //!< total amount of pointers allocated
+    count_t         ptrs_freed;                 //!< total amount of pointers freed
+    size_t          find_index_word;            //!< speed up find index
+    index_t         first_index;                //!< required to start defrag
+    index_t         last_index;                 //!< required to allocate off heap
+    uint8_t         status_;                    //!< TM_DEFRAG_* status bits
+    index_t         defrag_index;               //!< used during defrag
+    index_t         defrag_prev;                //!< used during defrag
+
+    /*-----------------------------------------------------------------------*/
+    /*      Access Pool and index characteristics (the tinymem.c macros)     */
+    blocks_t &  LOCATION(const size_t index)    { return pointers[index].loc; }
+    blocks_t    LOCATION(const size_t index) const { return pointers[index].loc; }
+    index_t &   NEXT(const size_t index)        { return pointers[index].next; }
+    index_t     NEXT(const size_t index) const  { return pointers[index].next; }
+    blocks_t &  HEAP()                          { return pointers[0].loc; }
+    blocks_t    HEAP() const                    { return pointers[0].loc; }
+    blocks_t    BLOCKS(const size_t index) const {
+        return LOCATION(NEXT(index)) - LOCATION(index);
+    }
+    blocks_t    BLOCKS_LEFT() const             { return pool_blocks - filled_blocks; }
+    blocks_t    HEAP_LEFT() const               { return pool_blocks - HEAP(); }
+    size_t      PTRS_USED() const               { return (size_t)ptrs_filled + ptrs_freed; }
+    size_t      PTRS_AVAILABLE() const          { return indexes - PTRS_USED(); }
+    free_block * free_p(const size_t index) const {
+        return (free_block *)(pool + LOCATION(index));
+    }
+
+    static blocks_t align_blocks(const size_t size){
+        return (blocks_t)((size + block_size - 1) / block_size);
+    }
+    static unsigned int bit(const size_t index){
+        return 1u << (index % int_bits);
+    }
+    bool        FILLED(const size_t index) const { return filled[index / int_bits] & bit(index); }
+    void        FILLED_SET(const size_t index)  { filled[index / int_bits] |= bit(index); }
+    void        FILLED_CLEAR(const size_t index){ filled[index / int_bits] &= ~bit(index); }
+    bool        POINTS(const size_t index) const { return points[index / int_bits] & bit(index); }
+    void        POINTS_SET(const size_t index)  { points[index / int_bits] |= bit(index); }
+    void        POINTS_CLEAR(const size_t index){ points[index / int_bits] &= ~bit(index); }
+
+    /*-----------------------------------------------------------------------*/
+    bool        defrag(){
+        int32_t clocks_left = defrag_policy::slice_clocks;
+        blocks_t blocks, location;
+        if(!(status_ & TM_DEFRAG_IP)){
+            defrag_index = first_index;
+            defrag_prev = 0;
+            status_ &= ~TM_ANY_DEFRAG;
+            status_ |= TM_DEFRAG_FULL_IP;
+        }
+        if(!defrag_index) goto done;
+        while(NEXT(defrag_index)){
+            if(!FILLED(defrag_index)){
+                clocks_left -= 30 + index_remove_clocks + split_clocks;
+                if(!FILLED(NEXT(defrag_index))){
+                    index_join(defrag_index, NEXT(defrag_index), &clocks_left);
+                    if(clocks_left < 0) return true;
+                }
+                if(!NEXT(defrag_index)) break;
+
+                assert(FILLED(NEXT(defrag_index)));
+                blocks = BLOCKS(NEXT(defrag_index));        // store size of actual data
+                location = LOCATION(NEXT(defrag_index));    // location of actual data
+                clocks_left -= (blocks * block_size + sizeof(int) - 1) / sizeof(int);
+
+                // Make index "filled", we will split it up later
+                freed_remove(defrag_index);
+                FILLED_SET(defrag_index);
+                ptrs_filled++, filled_blocks += BLOCKS(defrag_index);
+                ptrs_freed--, freed_blocks -= BLOCKS(defrag_index);
+
+                // Do an odd join, where the locations are just equal
+                LOCATION(NEXT(defrag_index)) = LOCATION(defrag_index);
+
+                // Now remove the index. Its NEXT and LOCATION stay valid
+                index_remove(defrag_index, defrag_prev, true);
+                defrag_prev = NEXT(defrag_index);   // defrag_index was removed
+
+                memmove(pool + LOCATION(defrag_prev), pool + location,
+                        (size_t)blocks * block_size);
+                if(!FILLED(NEXT(defrag_prev))){
+                    index_join(defrag_prev, NEXT(defrag_prev), &clocks_left);
+                }
+                assert(FILLED(NEXT(defrag_prev)));  // it will never "join up"
+                if(!index_split(defrag_prev, blocks, defrag_index)){
+                    assert(0);
+                } // note: defrag_index is now invalid (split used it)
+                defrag_index = NEXT(defrag_prev);
+                assert(!FILLED(defrag_index));
+            } else{
+                clocks_left -= 10;
+                defrag_prev = defrag_index;
+                defrag_index = NEXT(defrag_index);
+            }
+            if(clocks_left < 0) return true;
+        }
+done:
+        if(!FILLED(defrag_index)) index_remove(defrag_index, defrag_prev, true);
+        status_ &= ~TM_DEFRAG_IP;
+        status_ |= TM_DEFRAG_FULL_DONE;
+        defrag_index = 0;
+        defrag_prev = 0;
+        return false;
+    }
+
+    /*-----------------------------------------------------------------------*/
+    index_t     find_index(){
+        uint8_t loop;
+        unsigned int bits;
+        if(!PTRS_AVAILABLE()) return 0;
+        for(loop=0; loop<2; loop++){
+            for(; find_index_word < bit_words; find_index_word++){
+                bits = points[find_index_word];
+                if(bits != ~0u){
+#ifdef __GNUC__
+                    return find_index_word * int_bits + __builtin_ctz(~bits);
+#else
+                    size_t b = 0;
+                    while(bits & 1){ bits >>= 1; b++; }
+                    return find_index_word * int_bits + b;
+#endif
+                }
+            }
+            find_index_word = 0;
+        }
+        assert(0);
+        return 0;
+    }
+
+    /*-----------------------------------------------------------------------*/
+    /*      freed bins                                                       */
+    static uint8_t freed_bin(const blocks_t blocks){
+        uint8_t bin;
+        if(blocks < 4) return blocks - 1;
+        // 4-7 -> 3, 8-15 -> 4, ..., >= 1024 -> 11
+        for(bin=3; bin<freed_bins - 1 && (blocks >> (bin - 1)) > 1; bin++);
+        return bin;
+    }
+
+    static uint8_t freed_bin_get(const blocks_t blocks){
+        // the bin that only holds indexes with at least blocks
+        if(blocks <= 3) return blocks - 1;
+        if(!(blocks & (blocks - 1)) && blocks <= 1024) return freed_bin(blocks);
+        return freed_bin(blocks) + 1;
+    }
+
+    void        freed_remove(const index_t index){
+        // must be called BEFORE any changes to the index's size
+        free_block *f = free_p(index);
+        assert(!FILLED(index));
+        if(f->prev) free_p(f->prev)->next = f->next;
+        else{
+            assert(freed[freed_bin(BLOCKS(index))] == index);
+            freed[freed_bin(BLOCKS(index))] = f->next;
+        }
+        if(f->next) free_p(f->next)->prev = f->prev;
+    }
+
+    void        freed_insert(const index_t index){
+        uint8_t bin = freed_bin(BLOCKS(index));
+        free_block *f = free_p(index);
+        assert(!FILLED(index));
+        f->next = freed[bin];
+        f->prev = 0;
+        if(freed[bin]) free_p(freed[bin])->prev = index;
+        freed[bin] = index;
+    }
+
+    index_t     freed_get(const blocks_t blocks){
+        index_t index;
+        uint8_t bin = freed_bin_get(blocks);
+        if(bin == freed_bins){  // size is off the binning charts
+            for(index=freed[freed_bins - 1]; index; index=free_p(index)->next){
+                if(BLOCKS(index) >= blocks) goto found;
+            }
+        }
+        for(; bin<freed_bins; bin++){
+            index = freed[bin];
+            if(index){
+found:
+                freed_remove(index);
+                FILLED_SET(index);
+                filled_blocks += BLOCKS(index);
+                freed_blocks -= BLOCKS(index);
+                ptrs_filled++;
+                ptrs_freed--;
+                return index;
+            }
+        }
+        return 0;
+    }
+
+    /*-----------------------------------------------------------------------*/
+    /*      index list                                                       */
+    void        index_extend(const index_t index, const blocks_t blocks){
+        // extend a filled index onto the heap
+        assert(!POINTS(index));
+        POINTS_SET(index);
+        pointers[index] = poolptr{HEAP(), 0};
+        HEAP() += blocks;
+        if(last_index) NEXT(last_index) = index;
+        last_index = index;
+        if(!first_index) first_index = index;
+        FILLED_SET(index);
+        filled_blocks += blocks;
+        ptrs_filled++;
+    }
+
+    void        index_remove(const index_t index, const index_t prev_index, const bool defragging){
+        // Completely remove the index and combine it into prev_index (or the heap)
+        // Note: NEXT(index) and LOCATION(index) must not change
+        assert(index);
+        switch(((FILLED(prev_index) ? 1:0) << 1) + (FILLED(index) ? 1:0)){
+            case 0:     // merging two free values
+                freed_remove(index);
+                ptrs_freed--;
+                if(!NEXT(index)) freed_blocks -= BLOCKS(index);
+                break;
+            case 2:     // growing prev_index "up"
+                freed_remove(index);
+                freed_blocks -= BLOCKS(index); ptrs_freed--;
+                if(NEXT(index)) filled_blocks += BLOCKS(index);
+                break;
+            case 3:     // combining two filled indexes, used ONLY in defrag
+                assert(defragging);
+                ptrs_filled--;
+                break;
+            default:
+                assert(0);
+        }
+        if(index == first_index) first_index = NEXT(index);
+        if(NEXT(index)){
+            NEXT(prev_index) = NEXT(index);
+        } else{     // this is the last index, move the heap
+            assert(last_index == index);
+            last_index = prev_index;
+            if(prev_index)  NEXT(prev_index) = 0;
+            else            first_index = 0;
+            HEAP() = LOCATION(index);
+        }
+        FILLED_CLEAR(index);
+        POINTS_CLEAR(index);
+        if(!defragging){
+            if(index == defrag_index){
+                defrag_index = NEXT(index);     // index is gone, defrag should do next index
+            } else if(index == defrag_prev){
+                defrag_prev = prev_index;       // index is gone, joined with prev_index
+            }
+        }
+    }
+
+    void        index_join(const index_t index, index_t with_index, int32_t *clocks_left){
+        // join index with all the free indexes after it
+        do{
+            if(clocks_left) *clocks_left -= 8;
+            assert(!FILLED(with_index));
+            if(!FILLED(index)){
+                if(clocks_left) *clocks_left -= freed_remove_clocks;
+                freed_remove(index);    // rebin, remove before changing size
+            }
+            if(clocks_left) *clocks_left -= index_remove_clocks;
+            index_remove(with_index, index, clocks_left != NULL);
+            if(!FILLED(index)) freed_insert(index);
+            with_index = NEXT(index);
+        } while(!FILLED(with_index));
+    }
+
+    bool        index_split(const index_t index, const blocks_t blocks, index_t new_index){
+        assert(blocks < BLOCKS(index));
+        if(!FILLED(NEXT(index))){
+            // If next index is free, always join it first. This also frees up
+            //      new_index to use however we want
+            new_index = NEXT(index);
+            index_join(index, new_index, NULL);
+        } else if(!new_index){
+            new_index = find_index();
+            if(!new_index) return false;
+        }
+        assert(!POINTS(new_index));
+        assert(!FILLED(new_index));
+        POINTS_SET(new_index);
+        if(FILLED(index)){  // there will be some newly freed data
+            freed_blocks += BLOCKS(index) - blocks;
+            filled_blocks -= BLOCKS(index) - blocks;
+        }
+        ptrs_freed++;
+        pointers[new_index] = poolptr{(blocks_t)(LOCATION(index) + blocks), NEXT(index)};
+        NEXT(index) = new_index;
+        freed_insert(new_index);
+        if(last_index == index) last_index = new_index;
+        return true;
+    }
+};
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           Where SegmentedPool gets its segments from
+ *                  map() returns NULL if there is no memory
+ */
+struct SegmentHeap {
+    static void *   map(size_t bytes)           { return ::operator new(bytes, std::nothrow); }
+    static void     unmap(void *ptr, size_t)    { ::operator delete(ptr); }
+};
+
+#ifdef __linux__
+struct SegmentMmap {
+    // pages are only backed once they are touched, and unmap returns them
+    static void *   map(size_t bytes){
+        void *ptr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return ptr == MAP_FAILED ? NULL : ptr;
+    }
+    static void     unmap(void *ptr, size_t bytes){ munmap(ptr, bytes); }
+};
+typedef SegmentMmap SegmentDefault;
+#else
+typedef SegmentHeap SegmentDefault;
+#endif
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief           A pool that grows by adding segments
+ *
+ *                  Every segment is a Pool<Config> with its own heap, index
+ *                  chain and defrag. Segments are mapped when all of the
+ *                  existing ones are full, up to MaxSegments, and unmapped
+ *                  again by thread() once nothing is allocated in them. The
+ *                  first segment and one empty spare are kept, so a program
+ *                  that hovers at the end of a segment doesn't map and unmap
+ *                  it over and over.
+ *
+ *                  The indexes of all segments share one index space:
+ *                  segment * Config::indexes + index in the segment. An
+ *                  allocation never spans segments, so it is limited to
+ *                  Config::pool_size.
+ *
+ *                      typedef tinymem::PoolConfig<8, 1 << 20, 4096> SegmentConfig;
+ *                      static tinymem::SegmentedPool<SegmentConfig, 16> pool;
+ */
+template<typename Config, size_t MaxSegments, typename SegmentAlloc = SegmentDefault>
+class SegmentedPool {
+public:
+    typedef Pool<Config>                                            segment_t;
+    typedef typename uint_fit<MaxSegments * Config::indexes - 1>::type index_t;
+    typedef typename segment_t::index_t                             local_t;
+
+    static constexpr size_t     segment_indexes = Config::indexes;
+    static constexpr size_t     max_segments = MaxSegments;
+
+    static_assert(MaxSegments >= 1 && MaxSegments * Config::indexes - 1 <= UINT32_MAX,
+                  "too many segments for the index space");
+
+    SegmentedPool() : thread_segment(0)  {
+        for(size_t i=0; i<MaxSegments; i++) segments[i] = NULL;
+    }
+    SegmentedPool(const SegmentedPool &) = delete;
+    SegmentedPool & operator=(const SegmentedPool &) = delete;
+    ~SegmentedPool()                        { reset(); }
+
+    /*-----------------------------------------------------------------------*/
+    /**
+     * \brief       unmap every segment. ALL DATA WILL BE LOST
+     */
+    void        reset(){
+        for(size_t i=0; i<MaxSegments; i++) unmap(i);
+    }
+
+    size_t      segment_count() const {
+        size_t i, count = 0;
+        for(i=0; i<MaxSegments; i++) count += segments[i] != NULL;
+        return count;
+    }
+
+    /*-----------------------------------------------------------------------*/
+    size_t      size_of(const index_t index) const {
+        return segment(index)->size_of(local(index));
+    }
+
+    void *      void_p(const index_t index){
+        if(!index) return NULL;
+        return segment(index)->void_p(local(index));
+    }
+
+    bool        valid(const index_t index) const {
+        if(index / segment_indexes >= MaxSegments) return false;
+        if(!segments[index / segment_indexes]) return false;
+        return segment(index)->valid(local(index));
+    }
+
+    /*-----------------------------------------------------------------------*/
+    index_t     alloc(const size_t size){
+        // the first segments are filled first, so the last ones can empty
+        size_t i;
+        local_t index;
+        for(i=0; i<MaxSegments; i++){
+            if(!segments[i] || segments[i]->bytes_left() < size) continue;
+            index = segments[i]->alloc(size);
+            if(index) return global(i, index);
+        }
+        for(i=0; i<MaxSegments; i++){
+            if(segments[i]) continue;
+            if(!map(i)) return 0;
+            index = segments[i]->alloc(size);
+            return index ? global(i, index) : 0;
+        }
+        return 0;
+    }
+
+    index_t     realloc(const index_t index, const size_t size){
+        index_t new_index;
+        local_t grown;
+        if(!index) return alloc(size);
+        if(!size){
+            free(index);
+            return 0;
+        }
+        grown = segment(index)->realloc(local(index), size);
+        if(grown) return global(index / segment_indexes, grown);
+        // the segment is full, move the data to another one
+        new_index = alloc(size);
+        if(!new_index) return 0;
+        memcpy(void_p(new_index), void_p(index), size_of(index));
+        free(index);
+        return new_index;
+    }
+
+    void        free(const index_t index){
+        segment_t *seg;
+        if(!index) return;
+        seg = segment(index);
+        seg->free(local(index));
+        // the freed data of an empty segment is in holes until it is
+        //      defragged, start it over so it can all be allocated
+        if(seg->bytes_left() == Config::pool_size) seg->reset();
+    }
+
+    /*-----------------------------------------------------------------------*/
+    /**
+     * \brief       run one segment's memory manager for a short stint of
+     *              time and unmap the segments that are empty, but the
+     *              first empty one
+     * \return      true if a segment still has a defrag to do
+     */
+    bool        thread(){
+        size_t i;
+        bool more = false, spare = false;
+        for(i=0; i<MaxSegments; i++){
+            if(!segments[i] || segments[i]->bytes_left() != Config::pool_size) continue;
+            // alloc fills the first segments first, so the first empty one
+            //      is the one that is used again
+            if(i && spare) unmap(i);
+            spare = true;
+        }
+        // one segment per call, so a call takes as long as for one pool
+        for(i=0; i<MaxSegments; i++){
+            thread_segment = (thread_segment + 1) % MaxSegments;
+            if(segments[thread_segment]){
+                segments[thread_segment]->thread();
+                break;
+            }
+        }
+        for(i=0; i<MaxSegments; i++){
+            if(segments[i] && (segments[i]->status() & TM_ANY_DEFRAG)) more = true;
+        }
+        return more;
+    }
+
+private:
+    static local_t  local(const index_t index)  { return (local_t)(index % segment_indexes); }
+    static index_t  global(const size_t seg, const local_t index){
+        return (index_t)(seg * segment_indexes + index);
+    }
+    segment_t *     segment(const index_t index) const {
+        assert(segments[index / segment_indexes]);
+        return segments[index / segment_indexes];
+    }
+
+    bool        map(const size_t i){
+        void *ptr = SegmentAlloc::map(sizeof(segment_t));
+        if(!ptr) return false;
+        segments[i] = new (ptr) segment_t();
+        return true;
+    }
+    void        unmap(const size_t i){
+        if(!segments[i]) return;
+        segments[i]->~segment_t();
+        SegmentAlloc::unmap(segments[i], sizeof(segment_t));
+        segments[i] = NULL;
+    }
+
+    segment_t       *segments[MaxSegments];
+    size_t          thread_segment;
+};
+
+}   // namespace tinymem
+
+#endif
@@ -0,0 +1,113 @@
+#ifdef __linux__   // epoll and timerfd
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "tinymem_sched.h"
+
+#define TESTprint(...)      printf(__VA_ARGS__)
+
+static uint64_t     now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+bool            tm_sched_init(tm_sched *sched, int epoll_fd, uint32_t period_us){
+    struct itimerspec spec = {
+        .it_interval = {period_us / 1000000, (period_us % 1000000) * 1000},
+        .it_value = {period_us / 1000000, (period_us % 1000000) * 1000}
+    };
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = sched};
+    *sched = (tm_sched) {.period_us = period_us, .slice_ns = 0};
+    sched->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(sched->timer_fd < 0) return false;
+    if(timerfd_settime(sched->timer_fd, 0, &spec, NULL)
+            || (epoll_fd >= 0 && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sched->timer_fd, &event))){
+        tm_sched_close(sched);
+        return false;
+    }
+    return true;
+}
+
+uint32_t        tm_sched_run(tm_sched *sched, int ready, uint64_t deadline_ns){
+    uint64_t expirations, start, now = now_ns();
+    uint32_t slices = 0;
+    if(read(sched->timer_fd, &expirations, sizeof(expirations)) < 0) expirations = 0;
+    if(!deadline_ns) deadline_ns = now + sched->period_us * 1000ull;
+    if(ready > 0){
+        sched->skipped++;
+    } else{
+        // stop when the next slice could run past the deadline
+        while(now + sched->slice_ns < deadline_ns){
+            start = now;
+            slices++;
+            if(!tm_thread()) break;
+            now = now_ns();
+            // the estimate goes up at once but down slowly, so that one
+            //      slow slice (a page fault) does not stop defrag for good
+            if(now - start > sched->slice_ns) sched->slice_ns = now - start;
+            else sched->slice_ns -= (sched->slice_ns - (now - start)) / 8;
+        }
+        if(!slices) sched->slice_ns /= 2;
+    }
+    sched->slices += slices;
+    sched->progress = tm_defrag_progress();
+    return slices;
+}
+
+void            tm_sched_close(tm_sched *sched){
+    if(sched->timer_fd >= 0) close(sched->timer_fd);
+    sched->timer_fd = -1;
+}
+
+#ifdef TM_TESTS
+/*---------------------------------------------------------------------------*/
+/*      Tests                                                                */
+#define mu_assert(test) if (!(test)) {TESTprint("MU ASSERT FAILED(%s,%u): \"%s\"\n", \
+        __FILE__, __LINE__, #test); return "FAILED\n";}
+
+/**
+ * A fragmented pool must be defragmented from the timer, but not while
+ * other events are ready
+ */
+char *test_tm_sched(){
+    tm_sched sched;
+    struct epoll_event event;
+    tm_index_t indexes[TM_POOL_INDEXES];
+    uint32_t i, n, remaining;
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    mu_assert(epoll_fd >= 0);
+    mu_assert(tm_sched_init(&sched, epoll_fd, 200));
+
+    tm_reset();
+    for(n=0; n<TM_POOL_INDEXES; n++){
+        indexes[n] = tm_alloc(64);
+        if(!indexes[n]) break;
+    }
+    for(i=0; i<n; i+=2) tm_free(indexes[i]);
+    mu_assert(!tm_alloc(1024));         // requests a defrag
+    remaining = tm_defrag_progress().remaining_bytes;
+    mu_assert(remaining);
+
+    mu_assert(epoll_wait(epoll_fd, &event, 1, 1000) == 1 && event.data.ptr == &sched);
+    mu_assert(!tm_sched_run(&sched, 1, 0));
+    mu_assert(sched.skipped == 1 && sched.progress.remaining_bytes == remaining);
+
+    for(i=0; i<10000 && (sched.progress.status & TM_ANY_DEFRAG); i++){
+        mu_assert(epoll_wait(epoll_fd, &event, 1, 1000) == 1);
+        // a deadline 20us away only leaves room for a few slices
+        tm_sched_run(&sched, 0, now_ns() + 20000);
+        if(sched.progress.status & TM_DEFRAG_IP){
+            mu_assert(sched.progress.remaining_bytes < remaining);
+        }
+    }
+    mu_assert(!(sched.progress.status & TM_ANY_DEFRAG));
+    mu_assert(sched.slices > 1 && !sched.progress.freed_bytes);
+    mu_assert(tm_alloc(1024));
+
+    tm_sched_close(&sched);
+    close(epoll_fd);
+    return NULL;
+}
+#endif
+#endif
@@ -0,0 +1,76 @@
+#ifndef __tinymem_sched_h
+#define __tinymem_sched_h
+/*---------------------------------------------------------------------------*/
+/**
+ * \file            Idle time defrag for epoll event loops (linux)
+ *
+ *                  Instead of calling tm_thread in the main loop, the
+ *                  scheduler owns a periodic timerfd in the loop's epoll set.
+ *                  When the timer fires it runs tm_thread slices, but only
+ *                  if no other event was ready in the same epoll_wait and
+ *                  only while a slice still fits before the loop's next
+ *                  deadline:
+ *
+ *                      tm_sched sched;
+ *                      tm_sched_init(&sched, epoll_fd, 1000);
+ *                      while(1){
+ *                          n = epoll_wait(epoll_fd, events, MAX, timeout_ms);
+ *                          for(i=0; i<n; i++){
+ *                              if(events[i].data.ptr == &sched){
+ *                                  tm_sched_run(&sched, n - 1, next_deadline_ns);
+ *                              } else ...
+ *                          }
+ *                      }
+ *
+ *                  Deadlines are CLOCK_MONOTONIC in nanoseconds, 0 if the
+ *                  loop has none. The backlog is in tm_defrag_progress().
+ */
+#include "tinymem.h"
+
+#ifdef __linux__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    int             timer_fd;       //!< registered with data.ptr = the tm_sched
+    uint32_t        period_us;      //!< how often the timer fires
+    uint32_t        slice_ns;       //!< estimated time of a tm_thread slice
+    uint32_t        slices;         //!< slices that were run
+    uint32_t        skipped;        //!< timer ticks given up to ready I/O
+    tm_progress_t   progress;       //!< backlog after the last tm_sched_run
+} tm_sched;
+
+/**
+ * \brief           create the timer and add it to epoll_fd (if >= 0,
+ *                  otherwise add sched->timer_fd to your loop yourself)
+ * \return          false if the timer could not be created or added
+ */
+bool                tm_sched_init(tm_sched *sched, int epoll_fd, uint32_t period_us);
+
+/**
+ * \brief           call when the timer is readable
+ * \param ready     number of other events that are ready. If not 0 no
+ *                  defrag is done, the I/O goes first
+ * \param deadline_ns   when the loop has to do something else (0: none).
+ *                  Without a deadline, slices run for at most one period
+ * \return          number of tm_thread slices that were run
+ */
+uint32_t            tm_sched_run(tm_sched *sched, int ready, uint64_t deadline_ns);
+
+/**
+ * \brief           close the timer (it is removed from epoll as well)
+ */
+void                tm_sched_close(tm_sched *sched);
+
+#ifdef TM_TESTS
+char                *test_tm_sched();
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+#endif
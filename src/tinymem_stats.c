@@ -0,0 +1,150 @@
+#include "tinymem_stats.h"
+
+#if defined(TM_STATS) && defined(__linux__)     // POSIX shared memory
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define TESTprint(...)      printf(__VA_ARGS__)
+#define TM_STATS_TRIES      (100000)
+
+static uint64_t     now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+tm_stats_shm    *tm_stats_open(const char *name){
+    tm_stats_shm *shm;
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+    if(fd < 0) return NULL;
+    if(ftruncate(fd, sizeof(tm_stats_shm))){
+        close(fd);
+        return NULL;
+    }
+    shm = mmap(NULL, sizeof(tm_stats_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(shm == MAP_FAILED) return NULL;
+    // the counters are only valid once magic is set (see tm_stats_read)
+    __atomic_store_n(&shm->magic, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&shm->seq, 0, __ATOMIC_RELAXED);
+    shm->size = sizeof(tm_stats_shm);
+    shm->pid = getpid();
+    shm->published = 0;
+    __atomic_store_n(&shm->magic, TM_STATS_MAGIC, __ATOMIC_RELEASE);
+    return shm;
+}
+
+void            tm_stats_publish(tm_stats_shm *shm){
+    tm_stats_t stats;
+    tm_stats(&stats);       // outside of the write, it takes the pool lock
+    __atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    shm->stats = stats;
+    shm->time_ns = now_ns();
+    shm->published++;
+    __atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELEASE);
+}
+
+void            tm_stats_close(tm_stats_shm *shm, const char *name){
+    munmap(shm, sizeof(tm_stats_shm));
+    if(name) shm_unlink(name);
+}
+
+const tm_stats_shm *tm_stats_attach(const char *name){
+    tm_stats_shm *shm;
+    struct stat st;
+    int fd = shm_open(name, O_RDONLY, 0);
+    if(fd < 0) return NULL;
+    if(fstat(fd, &st) || st.st_size != sizeof(tm_stats_shm)){
+        close(fd);
+        return NULL;
+    }
+    shm = mmap(NULL, sizeof(tm_stats_shm), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(shm == MAP_FAILED) return NULL;
+    if(__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != TM_STATS_MAGIC
+            || shm->size != sizeof(tm_stats_shm)){
+        munmap(shm, sizeof(tm_stats_shm));
+        return NULL;
+    }
+    return shm;
+}
+
+bool            tm_stats_read(const tm_stats_shm *shm, tm_stats_shm *copy){
+    uint32_t seq, tries;
+    // bounded, the publisher may have died in the middle of a write
+    for(tries=0; tries<TM_STATS_TRIES; tries++){
+        seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+        if(seq & 1) continue;
+        *copy = *shm;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) == seq) return copy->published != 0;
+    }
+    return false;
+}
+
+void            tm_stats_detach(const tm_stats_shm *shm){
+    munmap((void *)shm, sizeof(tm_stats_shm));
+}
+
+#ifdef TM_TESTS
+/*---------------------------------------------------------------------------*/
+/*      Tests                                                                */
+#define mu_assert(test) if (!(test)) {TESTprint("MU ASSERT FAILED(%s,%u): \"%s\"\n", \
+        __FILE__, __LINE__, #test); return "FAILED\n";}
+
+/**
+ * A second mapping of the segment (as another process would have) must see
+ * what was published, and only once it was published
+ */
+char *test_tm_stats(){
+    char name[32];
+    tm_stats_shm *shm, copy;
+    const tm_stats_shm *reader;
+    tm_index_t indexes[8];
+    uint32_t i, allocs = 0, threads = 0;
+    snprintf(name, sizeof(name), "/tinymem_test_%u", (unsigned)getpid());
+    shm = tm_stats_open(name);
+    mu_assert(shm);
+    reader = tm_stats_attach(name);
+    mu_assert(reader);
+    mu_assert(!tm_stats_read(reader, &copy));
+
+    tm_reset();
+    for(i=0; i<8; i++) indexes[i] = tm_alloc(32 + i * 64);
+    tm_free(indexes[1]);
+    tm_free(indexes[5]);
+    tm_stats_publish(shm);
+    mu_assert(tm_stats_read(reader, &copy));
+    mu_assert(copy.published == 1 && copy.pid == (uint32_t)getpid());
+    mu_assert(copy.stats.indexes_used == 6 && copy.stats.indexes_freed == 2);
+    mu_assert(copy.stats.freed_bytes == 96 + 352);
+    mu_assert(copy.stats.used_bytes + copy.stats.freed_bytes + copy.stats.heap_bytes
+              == copy.stats.pool_bytes);
+    for(i=0; i<TM_STATS_BINS; i++){
+        mu_assert(!copy.stats.bin_count[i] == !copy.stats.bin_bytes[i]);
+    }
+    for(i=0; i<TM_STATS_BUCKETS; i++) allocs += copy.stats.alloc_ns[i];
+    mu_assert(allocs == 8);
+
+    mu_assert(!tm_alloc(copy.stats.heap_bytes + 64));     // requests a defrag
+    tm_stats_publish(shm);
+    mu_assert(tm_stats_read(reader, &copy) && copy.published == 2);
+    mu_assert(copy.stats.progress.status & TM_ANY_DEFRAG);
+    while(tm_thread()) threads++;
+    tm_stats_publish(shm);
+    mu_assert(tm_stats_read(reader, &copy));
+    mu_assert(!copy.stats.freed_bytes && !copy.stats.indexes_freed);
+    for(i=0, allocs=0; i<TM_STATS_BUCKETS; i++) allocs += copy.stats.thread_ns[i];
+    mu_assert(allocs == threads + 1);
+
+    tm_stats_detach(reader);
+    tm_stats_close(shm, name);
+    mu_assert(!tm_stats_attach(name));
+    tm_reset();
+    return NULL;
+}
+#endif
+#endif
@@ -0,0 +1,86 @@
+#ifndef __tinymem_stats_h
+#define __tinymem_stats_h
+/*---------------------------------------------------------------------------*/
+/**
+ * \file            Publish the pool counters in shared memory (linux, TM_STATS)
+ *
+ *                  The program that owns the pool creates a named POSIX
+ *                  shared memory segment and publishes tm_stats() into it
+ *                  every now and then (for instance from the tm_sched timer):
+ *
+ *                      tm_stats_shm *shm = tm_stats_open("/myprogram");
+ *                      ...
+ *                      tm_stats_publish(shm);
+ *
+ *                  Other processes attach to it read only (see
+ *                  tools/tinymem_top.c). The segment has a seqlock header:
+ *                  the publisher makes seq odd while it writes, and readers
+ *                  retry until they copied the counters with the same even
+ *                  seq. Readers never take the pool lock, so watching the
+ *                  pool costs the program nothing more than the publishing.
+ */
+#include "tinymem.h"
+
+#if defined(TM_STATS) && defined(__linux__)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TM_STATS_MAGIC      (0x746d7374)    // "tmst"
+
+typedef struct {
+    uint32_t        seq;            //!< odd while the counters are written
+    uint32_t        magic;          //!< TM_STATS_MAGIC
+    uint32_t        size;           //!< sizeof(tm_stats_shm) of the publisher
+    uint32_t        pid;            //!< process that publishes
+    uint64_t        time_ns;        //!< CLOCK_MONOTONIC of the last publish
+    uint32_t        published;      //!< number of publishes
+    tm_stats_t      stats;
+} tm_stats_shm;
+
+/**
+ * \brief           create (or reuse) the segment name, e.g. "/myprogram"
+ * \return          NULL if it couldn't be created
+ */
+tm_stats_shm        *tm_stats_open(const char *name);
+
+/**
+ * \brief           copy tm_stats() into the segment
+ */
+void                tm_stats_publish(tm_stats_shm *shm);
+
+/**
+ * \brief           unmap the segment, and remove it if name is not NULL
+ */
+void                tm_stats_close(tm_stats_shm *shm, const char *name);
+
+/**
+ * \brief           map the segment of another process read only
+ * \return          NULL if it doesn't exist or isn't a tinymem segment
+ *                  of this version
+ */
+const tm_stats_shm  *tm_stats_attach(const char *name);
+
+/**
+ * \brief           consistent copy of the published counters
+ * \return          false if nothing was published yet (or the publisher
+ *                  stopped in the middle of writing)
+ */
+bool                tm_stats_read(const tm_stats_shm *shm, tm_stats_shm *copy);
+
+/**
+ * \brief           unmap a segment from tm_stats_attach
+ */
+void                tm_stats_detach(const tm_stats_shm *shm);
+
+#ifdef TM_TESTS
+char                *test_tm_stats();
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+#endif
@@ -0,0 +1,68 @@
+/**
+ * Tests of tinymem_async.hpp: the loop hands out memory to coroutines,
+ * running defrag slices until a waiter fits
+ */
+#include "tinymem_async.hpp"
+#include "test_cpp.hpp"
+
+using namespace tinymem;
+
+struct alloc_result {
+    bool            done;
+    tm_index_t      index;
+};
+
+static task alloc_task(loop &owner, tm_size_t size, alloc_result &result){
+    result.index = co_await owner.alloc(size);
+    result.done = true;
+}
+
+static task yield_task(loop &owner, uint8_t times, uint8_t &resumed){
+    while(times--){
+        co_await owner.yield();
+        resumed++;
+    }
+}
+
+#define ASYNC_HOLES     (TM_POOL_SIZE / 64)
+
+/**
+ * A waiter on a fragmented pool is resumed once the defrag made room, a
+ * size bigger than the pool returns 0 without waiting, and poll() stops
+ * when there is nothing left to do
+ */
+char *test_async_hpp(){
+    static tm_index_t holes[ASYNC_HOLES];
+    alloc_result small = {}, fragmented = {}, huge = {}, behind = {};
+    loop owner;
+    size_t i, count = 0, polls;
+    uint8_t resumed = 0;
+    tm_reset();
+
+    alloc_task(owner, 100, small);              // fits, doesn't suspend
+    mu_assert(small.done && tm_valid(small.index) && !owner.waiting());
+
+    while(count < ASYNC_HOLES && (holes[count] = tm_alloc(64))) count++;
+    for(i=0; i<count; i+=2) tm_free(holes[i]);
+    alloc_task(owner, 128, fragmented);         // only fits after a defrag
+    mu_assert(!fragmented.done && owner.waiting() == 1);
+    mu_assert(tm_defrag_progress().status & TM_ANY_DEFRAG);
+    alloc_task(owner, 128, behind);             // waits its turn
+    mu_assert(!behind.done && owner.waiting() == 2);
+    alloc_task(owner, TM_POOL_SIZE + 1, huge);  // can never fit
+    mu_assert(huge.done && !huge.index && owner.waiting() == 2);
+    yield_task(owner, 3, resumed);
+
+    for(polls=0; owner.poll(); polls++) mu_assert(polls < 100000);
+    mu_assert(polls > 1);                       // the defrag took slices
+    mu_assert(resumed == 3 && !owner.waiting());
+    mu_assert(fragmented.done && tm_valid(fragmented.index));
+    mu_assert(tm_sizeof(fragmented.index) >= 128);
+    mu_assert(behind.done && tm_valid(behind.index) && behind.index != fragmented.index);
+    mu_assert(tm_valid(small.index) && tm_valid(holes[1]));
+
+    // with nothing waiting a poll has no work
+    mu_assert(!owner.poll());
+    tm_reset();
+    return NULL;
+}
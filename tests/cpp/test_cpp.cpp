@@ -0,0 +1,27 @@
+/**
+ * Runs the tests of the C++ headers. They are built against the C library,
+ * see make.py
+ */
+#include "test_cpp.hpp"
+
+#define mu_run_test(test) do{ char *out = test(); \
+        if(out){ printf("FAIL: %s: %s", #test, out); return out; } }while(0)
+
+char *all_tests(){
+    mu_run_test(test_pool_hpp);
+    mu_run_test(test_segmented_hpp);
+    mu_run_test(test_handle_hpp);
+    mu_run_test(test_vector_hpp);
+    mu_run_test(test_span_hpp);
+    mu_run_test(test_async_hpp);
+    return NULL;
+}
+
+int main(){
+    if(all_tests()){
+        printf("FAILED\n");
+        return 1;
+    }
+    printf("ALL PASSED\n");
+    return 0;
+}
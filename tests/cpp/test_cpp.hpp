@@ -0,0 +1,21 @@
+#ifndef __test_cpp_hpp
+#define __test_cpp_hpp
+/*---------------------------------------------------------------------------*/
+/**
+ * \file            Tests of the C++ headers, run by test_cpp.cpp
+ */
+#include <stdio.h>
+#include "tinymem.h"
+
+#define TESTprint(...)      printf(__VA_ARGS__)
+#define mu_assert(test) if (!(test)) {TESTprint("MU ASSERT FAILED(%s,%u): \"%s\"\n", \
+        __FILE__, __LINE__, #test); return (char *)"FAILED\n";}
+
+char                *test_pool_hpp();
+char                *test_segmented_hpp();
+char                *test_handle_hpp();
+char                *test_vector_hpp();
+char                *test_span_hpp();
+char                *test_async_hpp();
+
+#endif
@@ -0,0 +1,242 @@
+/**
+ * Tests of tinymem_pool.hpp: the checks of tinymem.c's tests, run against
+ * Pool<> with several configs
+ */
+#include <stdlib.h>
+#include "tinymem_pool.hpp"
+#include "test_cpp.hpp"
+
+using namespace tinymem;
+
+#define TEST_ENTRIES    (64)
+
+// uint8_t indexes, incremental defrag
+typedef PoolConfig<4, 4096, 128>                                SmallConfig;
+// uint16_t indexes, a defrag always finishes
+typedef PoolConfig<8, 1 << 16, 1024, uint16_t, DefragBlocking>  BigConfig;
+// uint32_t indexes in a pool that would fit uint8_t
+typedef PoolConfig<8, 8192, 128, uint32_t>                      WideConfig;
+
+static Pool<SmallConfig>    small_pool;
+static Pool<BigConfig>      big_pool;
+static Pool<WideConfig>     wide_pool;
+
+template<typename P>
+struct test_entry {
+    typename P::index_t     index;
+    size_t                  size;
+    uint8_t                 fill;
+};
+
+template<typename P>
+void entry_fill(P &pool, test_entry<P> &entry){
+    entry.fill = (uint8_t)rand();
+    memset(pool.void_p(entry.index), entry.fill, entry.size);
+}
+
+template<typename P>
+bool entry_check(P &pool, const test_entry<P> &entry, size_t size){
+    // the first size bytes still have the fill of the entry
+    const uint8_t *data = (const uint8_t *)pool.void_p(entry.index);
+    size_t i;
+    if(!pool.valid(entry.index) || pool.size_of(entry.index) < size) return false;
+    for(i=0; i<size; i++){
+        if(data[i] != entry.fill) return false;
+    }
+    return true;
+}
+
+/**
+ * Randomly alloc, free and realloc with defrag slices in between, the data
+ * and the bookkeeping must stay valid
+ */
+template<typename P>
+char *pool_random(P &pool, size_t max_size){
+    test_entry<P> entries[TEST_ENTRIES] = {};
+    test_entry<P> *entry;
+    typename P::index_t index;
+    size_t step, i, size;
+    pool.reset();
+    for(step=0; step<5000; step++){
+        entry = &entries[rand() % TEST_ENTRIES];
+        size = 1 + rand() % max_size;
+        if(!entry->index){
+            entry->index = pool.alloc(size);
+            if(entry->index){
+                entry->size = size;
+                entry_fill(pool, *entry);
+            }
+        } else if(rand() % 2){
+            pool.free(entry->index);
+            entry->index = 0;
+        } else{
+            index = pool.realloc(entry->index, size);
+            if(index){
+                // the data is kept, up to the new size
+                entry->index = index;
+                mu_assert(entry_check(pool, *entry, size < entry->size ? size : entry->size));
+                entry->size = size;
+                entry_fill(pool, *entry);
+            } else{
+                mu_assert(entry_check(pool, *entry, entry->size));
+            }
+        }
+        pool.thread();
+        if(!(step % 64)){
+            mu_assert(pool.isvalid());
+            for(i=0; i<TEST_ENTRIES; i++){
+                if(entries[i].index) mu_assert(entry_check(pool, entries[i], entries[i].size));
+            }
+        }
+    }
+    while(pool.status() & TM_ANY_DEFRAG) pool.thread();
+    mu_assert(pool.isvalid());
+    for(i=0; i<TEST_ENTRIES; i++){
+        if(entries[i].index) mu_assert(entry_check(pool, entries[i], entries[i].size));
+    }
+    pool.reset();
+    mu_assert(pool.bytes_left() == P::block_size * P::pool_blocks);
+    return NULL;
+}
+
+/**
+ * A failed allocation requests a defrag. When it is done all free space is
+ * at the top of the heap, with DefragBlocking in a single call to thread()
+ */
+template<typename P>
+char *pool_defrag(P &pool){
+    test_entry<P> entries[TEST_ENTRIES] = {};
+    const size_t size = P::block_size * P::pool_blocks / TEST_ENTRIES;
+    const bool blocking = P::defrag_policy::slice_clocks == INT32_MAX;
+    size_t i, calls = 0;
+    pool.reset();
+    for(i=0; i<TEST_ENTRIES; i++){
+        entries[i].index = pool.alloc(size);
+        mu_assert(entries[i].index);
+        entries[i].size = size;
+        entry_fill(pool, entries[i]);
+    }
+    mu_assert(!pool.alloc(1) && !pool.bytes_left());
+    for(i=0; i<TEST_ENTRIES; i+=2){
+        pool.free(entries[i].index);
+        entries[i].index = 0;
+    }
+    mu_assert(pool.isvalid());
+    mu_assert(!pool.alloc(2 * size));           // there is room, but in holes
+    mu_assert(pool.status() & TM_DEFRAG_FAST);
+    while(pool.status() & TM_ANY_DEFRAG){
+        pool.thread();
+        calls++;
+    }
+    mu_assert(blocking ? calls == 1 : calls > 1);
+    mu_assert(pool.status() & TM_DEFRAG_FULL_DONE);
+    mu_assert(pool.isvalid());
+    for(i=1; i<TEST_ENTRIES; i+=2){
+        mu_assert(entry_check(pool, entries[i], size));
+    }
+    mu_assert(pool.alloc(pool.bytes_left()));
+    mu_assert(!pool.bytes_left() && pool.isvalid());
+    pool.reset();
+    return NULL;
+}
+
+char *test_pool_hpp(){
+    char *out;
+    srand(42);
+    if((out = pool_random(small_pool, 100)))    return out;
+    if((out = pool_random(big_pool, 2000)))     return out;
+    if((out = pool_random(wide_pool, 300)))     return out;
+    if((out = pool_defrag(small_pool)))         return out;
+    if((out = pool_defrag(big_pool)))           return out;
+    if((out = pool_defrag(wide_pool)))          return out;
+    return NULL;
+}
+
+typedef PoolConfig<4, 1024, 32>                                 SegmentConfig;
+
+static SegmentedPool<SegmentConfig, 4>  segmented;
+
+#define SEGMENT_DATA    (200)           // 5 fit in a segment
+#define SEGMENT_ENTRIES (4 * 5)
+
+/**
+ * Indexes of SegmentedPool map to their segment, realloc moves data to
+ * another segment when its own is full, and empty segments are unmapped
+ * but for one spare
+ */
+char *test_segmented_hpp(){
+    typedef SegmentedPool<SegmentConfig, 4> pool_t;
+    test_entry<pool_t> entries[SEGMENT_ENTRIES] = {};
+    pool_t::index_t index;
+    size_t i, seg;
+    segmented.reset();
+    mu_assert(!segmented.segment_count());
+    for(i=0; i<SEGMENT_ENTRIES; i++){
+        entries[i].index = segmented.alloc(SEGMENT_DATA);
+        mu_assert(entries[i].index);
+        entries[i].size = SEGMENT_DATA;
+        entry_fill(segmented, entries[i]);
+        // the first segments are filled first
+        mu_assert(entries[i].index / pool_t::segment_indexes == i / 5);
+        mu_assert(segmented.segment_count() == i / 5 + 1);
+    }
+    mu_assert(!segmented.alloc(SEGMENT_DATA));  // all segments are full
+    mu_assert(!segmented.valid(4 * pool_t::segment_indexes));
+    for(i=0; i<SEGMENT_ENTRIES; i++){
+        mu_assert(entry_check(segmented, entries[i], SEGMENT_DATA));
+        mu_assert(segmented.size_of(entries[i].index) == SEGMENT_DATA);
+    }
+
+    // segment 0 is full, growing its data moves it to segment 3
+    for(i=SEGMENT_ENTRIES - 1; i>=17; i--){    // each joins the hole after it
+        segmented.free(entries[i].index);
+        entries[i].index = 0;
+    }
+    index = segmented.realloc(entries[0].index, 2 * SEGMENT_DATA);
+    mu_assert(index && index / pool_t::segment_indexes == 3);
+    mu_assert(!segmented.valid(entries[0].index));
+    entries[0].index = index;
+    mu_assert(entry_check(segmented, entries[0], SEGMENT_DATA));
+    entries[0].size = 2 * SEGMENT_DATA;
+    entry_fill(segmented, entries[0]);
+
+    // emptying segments 1 and 2 keeps 1 as the spare
+    for(i=5; i<15; i++){
+        segmented.free(entries[i].index);
+        entries[i].index = 0;
+    }
+    segmented.thread();
+    mu_assert(segmented.segment_count() == 3);
+    for(i=0; i<SEGMENT_ENTRIES; i++){
+        if(entries[i].index) mu_assert(entries[i].index / pool_t::segment_indexes != 2);
+    }
+    index = segmented.alloc(SEGMENT_DATA);      // the spare is used again
+    mu_assert(index && index / pool_t::segment_indexes == 1);
+    segmented.free(index);
+    segmented.thread();
+    mu_assert(segmented.segment_count() == 3);
+
+    // emptying segment 3 unmaps it, 1 stays the spare
+    for(i=15; i<SEGMENT_ENTRIES; i++){
+        segmented.free(entries[i].index);
+        entries[i].index = 0;
+    }
+    segmented.free(entries[0].index);
+    entries[0].index = 0;
+    segmented.thread();
+    mu_assert(segmented.segment_count() == 2);
+    for(i=1; i<5; i++){
+        mu_assert(entry_check(segmented, entries[i], SEGMENT_DATA));
+    }
+    // a new segment is mapped again when needed, in the first free slot
+    for(i=0; i<10; i++){
+        index = segmented.alloc(SEGMENT_DATA);
+        mu_assert(index);
+        seg = index / pool_t::segment_indexes;
+        mu_assert(seg == (i < 1 ? 0 : i < 6 ? 1 : 2));
+    }
+    mu_assert(segmented.segment_count() == 3);
+    segmented.reset();
+    mu_assert(!segmented.segment_count());
+    return NULL;
+}
@@ -0,0 +1,153 @@
+/**
+ * Tests of tinymem.hpp: handle, vector and span over the pool of tinymem.c
+ */
+#include "tinymem.hpp"
+#include "test_cpp.hpp"
+
+using namespace tinymem;
+
+struct point {
+    int32_t     x;
+    int32_t     y;
+    point() : x(0), y(0) {}
+    point(int32_t x, int32_t y) : x(x), y(y) {}
+};
+
+static_assert(alignof(point) <= block_align, "the test type must fit the blocks");
+
+static bool full_defrag(){
+    // fill the pool with holes and ask for more than a hole, which requests
+    //      a defrag. Run it to the end
+    tm_index_t holes[TM_POOL_SIZE / 64];
+    size_t i, count = 0;
+    bool requested;
+    while(count < TM_POOL_SIZE / 64 && (holes[count] = tm_alloc(64))) count++;
+    for(i=0; i<count; i+=2) tm_free(holes[i]);
+    if(tm_alloc(128)) return false;
+    requested = tm_defrag_progress().status & TM_ANY_DEFRAG;
+    while(tm_defrag_progress().status & TM_ANY_DEFRAG) tm_thread();
+    for(i=1; i<count; i+=2) tm_free(holes[i]);
+    return requested;
+}
+
+/**
+ * Handles own their index: moving one hands it over, and it is freed when
+ * the handle is reset or goes out of scope
+ */
+char *test_handle_hpp(){
+    tm_index_t index, filler;
+    point *before;
+    tm_reset();
+    {
+        handle<point> empty;
+        mu_assert(!empty && !empty.index() && empty.access().empty());
+        filler = tm_alloc(100);
+        handle<point> p = handle<point>::make(3, 4);
+        mu_assert(p && tm_valid(p.index()) && tm_sizeof(p.index()) >= sizeof(point));
+        mu_assert(p->x == 3 && (*p).y == 4);
+        index = p.index();
+
+        // the data follows the index through a defrag
+        before = p.get();
+        tm_free(filler);
+        mu_assert(full_defrag());
+        mu_assert(p.get() != before);
+        mu_assert(p.index() == index && p->x == 3 && p->y == 4);
+        mu_assert(p.access().size() == 1 && p.access()[0].y == 4);
+
+        handle<point> q(std::move(p));
+        mu_assert(!p && q.index() == index);
+        p = std::move(q);
+        mu_assert(p.index() == index && !q);
+
+        q.reset(tm_alloc(sizeof(point)));       // take over an index
+        mu_assert(q);
+        index = q.release();
+        mu_assert(!q && tm_valid(index));
+        tm_free(index);
+        index = p.index();
+    }
+    mu_assert(!tm_valid(index));                // freed by the destructor
+    tm_reset();
+    return NULL;
+}
+
+/**
+ * vector grows with tm_realloc and keeps its values through a defrag
+ */
+char *test_vector_hpp(){
+    tm_index_t index;
+    tm_size_t i, capacity;
+    uint32_t sum;
+    tm_reset();
+    {
+        vector<uint32_t> v;
+        mu_assert(v.empty() && !v.capacity() && !v.index());
+        for(i=0; i<1000; i++) mu_assert(v.push_back(i));
+        mu_assert(v.size() == 1000 && v.capacity() >= 1000);
+        for(i=0; i<1000; i++) mu_assert(v[i] == i);
+
+        mu_assert(full_defrag());
+        sum = 0;
+        for(uint32_t value : v.access()) sum += value;
+        mu_assert(sum == 999 * 1000 / 2);
+
+        v.pop_back();
+        mu_assert(v.size() == 999);
+        mu_assert(v.resize(1200, 7) && v.size() == 1200 && v[999] == 7 && v[1199] == 7);
+        capacity = v.capacity();
+        v.resize(10);
+        v.shrink_to_fit();
+        mu_assert(v.capacity() < capacity && v.capacity() >= 10 && v[9] == 9);
+
+        vector<uint32_t> w(std::move(v));
+        mu_assert(v.empty() && !v.index() && w.size() == 10 && w[5] == 5);
+        index = w.index();
+        w.clear();
+        w.shrink_to_fit();                      // gives everything back
+        mu_assert(!w.index() && !tm_valid(index));
+
+        // a full pool makes push_back fail instead of losing the data
+        mu_assert(w.reserve(4));
+        while(w.push_back(1));
+        mu_assert(w.size() && w.size() <= TM_POOL_SIZE / sizeof(uint32_t));
+        mu_assert(w[w.size() - 1] == 1);
+        index = w.index();
+    }
+    mu_assert(!tm_valid(index));                // freed by the destructor
+
+    // a value from the vector itself is read before growing moves it (and
+    //      the freed data gets the links of the freed bins)
+    tm_reset();
+    {
+        vector<uint32_t> a;
+        mu_assert(a.push_back(0x11111111));
+        while(a.size() < a.capacity()) mu_assert(a.push_back(a[0]));
+        mu_assert(tm_alloc(64));                // growing can't stay in place
+        index = a.index();
+        mu_assert(a.push_back(a[0]) && a.index() != index);
+        capacity = a.capacity();
+        while(a.size() < a.capacity()) mu_assert(a.push_back(a[0]));
+        mu_assert(tm_alloc(64));                // so has resize
+        mu_assert(a.resize(capacity + 1, a[0]) && a.size() == capacity + 1);
+        for(i=0; i<a.size(); i++) mu_assert(a[i] == 0x11111111);
+    }
+    tm_reset();
+    return NULL;
+}
+
+/**
+ * span is a plain view, it doesn't own anything
+ */
+char *test_span_hpp(){
+    int32_t data[4] = {1, 2, 3, 4};
+    int32_t sum = 0;
+    span<int32_t> s(data, 4), empty;
+    mu_assert(empty.empty() && !empty.data() && empty.begin() == empty.end());
+    mu_assert(s.size() == 4 && s.data() == data && s[2] == 3);
+    for(int32_t value : s) sum += value;
+    mu_assert(sum == 10);
+    s[0] = 5;
+    mu_assert(data[0] == 5);
+    return NULL;
+}
@@ -1,4 +1,7 @@
 #include "tinymem.h"
+#include "tinymem_ds.h"
+#include "tinymem_sched.h"
+#include "tinymem_stats.h"
 #include "minunit.h"
 
 #define TABLE_STANDIN NULL
@@ -12,7 +15,6 @@ char *all_tests(){
     /*mu_run_test(test_tm_pool_new);*/
     /*mu_run_test(test_tm_pool_alloc);*/
     /*mu_run_test(test_tm_free_basic);*/
-    /*mu_run_test(test_tm_pool_realloc);*/
     /*mu_run_test(test_tinymem);*/
     mu_test(test_tinymem(
         //  Times                   Indexes                 pool size
@@ -30,6 +32,53 @@ char *all_tests(){
     ));
     printf("COMPLETE tinymem_test: fills=%u, frees=%u, defrags=%u, purges=%u\n",
                fills, frees, defrags, purges);
+    mu_run_test(test_tm_pool_realloc);
+    mu_run_test(test_tm_alloc_wait);
+    mu_run_test(test_tm_defrag_resume);
+#ifndef TM_LARGE_SIZE   // the test fills the heap with big allocations
+    mu_run_test(test_tm_largest_free);
+#endif
+#ifdef __linux__
+    mu_run_test(test_tm_sched);
+#endif
+    mu_run_test(test_tm_list);
+    mu_run_test(test_tm_map);
+#ifdef TM_PAGE_RELEASE
+    mu_run_test(test_tm_trim);
+#endif
+#ifdef TM_LARGE_SIZE
+    mu_run_test(test_tm_large);
+#endif
+#ifdef TM_CHECK_STEPS
+    mu_run_test(test_tm_check);
+#endif
+#ifdef TM_PIN
+    mu_run_test(test_tm_pin);
+#endif
+#ifdef TM_TAGS
+    mu_run_test(test_tm_tags);
+#endif
+#ifdef TM_COMPRESS
+    mu_run_test(test_tm_compress);
+#endif
+#ifdef TM_REFCOUNT
+    mu_run_test(test_tm_refcount);
+#endif
+#ifdef TM_DEFRAG_THREADS
+    mu_run_test(test_tm_defrag_parallel);
+#endif
+#if defined(TM_STATS) && defined(__linux__) && !defined(TM_LARGE_SIZE)  // needs an allocation that doesn't fit
+    mu_run_test(test_tm_stats);
+#endif
+#ifdef TM_INDEX_CHUNK
+    mu_run_test(test_tm_index_grow);
+#endif
+#ifdef TM_THREADSAFE
+    mu_run_test(test_tm_threadsafe);
+#endif
+#ifdef TM_THREAD_POOLS
+    mu_run_test(test_tm_thread_pools);
+#endif
 #endif
 
     return NULL;
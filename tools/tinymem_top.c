@@ -0,0 +1,108 @@
+/**
+ * tinymem-top: live view of the pool of another process
+ *
+ * The process must publish its counters with tm_stats_publish (see
+ * tinymem_stats.h). This only maps the segment read only, it never touches
+ * the pool or its lock.
+ *
+ *      gcc -std=gnu99 -fgnu89-inline -O2 -DTM_STATS -Iplatform -Isrc \
+ *          tools/tinymem_top.c src/tinymem_stats.c src/tinymem.c -o tinymem-top
+ *      ./tinymem-top /myprogram [interval_ms] [-1]
+ *
+ * -1 prints once and exits (for scripts).
+ */
+#include <stdlib.h>
+#include <unistd.h>
+#include "tinymem_stats.h"
+
+#define BAR_WIDTH       (40)
+
+static void     print_bar(const char *name, uint32_t part, uint32_t total){
+    uint32_t i, width = total ? (uint64_t)part * BAR_WIDTH / total : 0;
+    printf("%-8s [", name);
+    for(i=0; i<BAR_WIDTH; i++) putchar(i < width ? '#' : ' ');
+    printf("] %10u B %5.1f%%\n", part, total ? 100.0 * part / total : 0.0);
+}
+
+static uint32_t percentile(const uint32_t *histogram, double fraction){
+    // upper bound in ns of the bucket that holds the percentile
+    uint64_t total = 0, seen = 0;
+    uint8_t bucket;
+    for(bucket=0; bucket<TM_STATS_BUCKETS; bucket++) total += histogram[bucket];
+    if(!total) return 0;
+    for(bucket=0; bucket<TM_STATS_BUCKETS; bucket++){
+        seen += histogram[bucket];
+        if(seen >= total * fraction) break;
+    }
+    return 1u << bucket;
+}
+
+static uint32_t count(const uint32_t *histogram){
+    uint32_t total = 0;
+    uint8_t bucket;
+    for(bucket=0; bucket<TM_STATS_BUCKETS; bucket++) total += histogram[bucket];
+    return total;
+}
+
+static void     print_latency(const char *name, const uint32_t *histogram){
+    printf("%-10s %12u %10u %10u %10u\n", name, count(histogram),
+           percentile(histogram, 0.5), percentile(histogram, 0.99),
+           percentile(histogram, 0.999));
+}
+
+static void     print_stats(const tm_stats_shm *shm){
+    const tm_stats_t *s = &shm->stats;
+    uint8_t bin;
+    printf("tinymem pid %u, publish #%u\n\n", shm->pid, shm->published);
+    print_bar("used", s->used_bytes, s->pool_bytes);
+    print_bar("freed", s->freed_bytes, s->pool_bytes);
+    print_bar("heap", s->heap_bytes, s->pool_bytes);
+    printf("indexes  %u used, %u freed of %u\n\n", s->indexes_used, s->indexes_freed, s->indexes);
+
+    printf("defrag   %s%s%s, %u B left to walk\n",
+           s->progress.status & TM_DEFRAG_IP ? "running" :
+               s->progress.status & TM_ANY_DEFRAG ? "requested" : "idle",
+           s->progress.status & TM_DEFRAG_FULL ? " (full)" : "",
+           s->progress.status & TM_ERROR ? ", POOL ERROR" : "",
+           s->progress.remaining_bytes);
+    printf("largest  %u B free in one piece, fragmentation %u%%\n\n",
+           s->progress.largest_free, s->progress.fragmentation);
+
+    printf("%-4s %10s %12s\n", "bin", "holes", "bytes");
+    for(bin=0; bin<TM_STATS_BINS; bin++){
+        if(s->bin_count[bin]) printf("%-4u %10u %12u\n", bin, s->bin_count[bin], s->bin_bytes[bin]);
+    }
+    printf("\n%-10s %12s %10s %10s %10s   (ns, bucket upper bounds)\n",
+           "latency", "calls", "p50", "p99", "p99.9");
+    print_latency("tm_alloc", s->alloc_ns);
+    print_latency("tm_thread", s->thread_ns);
+}
+
+int main(int argc, char *argv[]){
+    const tm_stats_shm *shm;
+    tm_stats_shm copy;
+    uint32_t interval_ms = argc > 2 ? atoi(argv[2]) : 1000;
+    bool once = argc > 3 && argv[3][0] == '-' && argv[3][1] == '1';
+    if(argc < 2){
+        fprintf(stderr, "usage: %s NAME [interval_ms] [-1]\n", argv[0]);
+        return 2;
+    }
+    shm = tm_stats_attach(argv[1]);
+    if(!shm){
+        fprintf(stderr, "%s: no tinymem stats segment\n", argv[1]);
+        return 1;
+    }
+    while(1){
+        if(!tm_stats_read(shm, &copy)){
+            if(once) return 1;
+        } else{
+            if(!once) printf("\033[H\033[J");   // clear the terminal
+            print_stats(&copy);
+            if(once) break;
+        }
+        fflush(stdout);
+        usleep(interval_ms * 1000);
+    }
+    tm_stats_detach(shm);
+    return 0;
+}